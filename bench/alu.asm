@@ -0,0 +1,59 @@
+        .org $7FFF
+
+; alu heavy loop, no memory traffic besides one variable
+; sprites and textures are moved off the variable so the renderer never has to catch up
+
+GPU_CTRL = $0901
+SPRTEX_P = $0909
+BKGTEX_P = $090B
+VAR      = $0010
+TEX      = $8000
+
+Reset:
+        lda #%11100100
+        sta GPU_CTRL
+        lda <TEX
+        sta SPRTEX_P
+        lda >TEX
+        sta SPRTEX_P
+        lda <TEX
+        sta BKGTEX_P
+        lda >TEX
+        sta BKGTEX_P
+        ldy #$00
+Outer:
+        ldx #$00
+Inner:
+        txa
+        add #3
+        xor #$55
+        rol
+        rol
+        ror
+        sal #1
+        sar #2
+        adx
+        ady
+        sux
+        suy
+        sub #7
+        inv
+        and #$7f
+        aor #$01
+        ina
+        dea
+        sta VAR
+        lda VAR
+        tay
+        cmp #$40
+        bin Lower
+        dey
+        jmp Next
+Lower:
+        iny
+Next:
+        inx
+        bne Inner
+        txy
+        tyx
+        jmp Outer
@@ -0,0 +1,68 @@
+        .org $7FFF
+
+; memory copy loops, rom -> ram and ram -> ram through indexed loads and the data port
+
+GPU_CTRL   = $0901
+PALETTE_ST = $0907
+PALETTE_DT = $0908
+BUF0       = $0400
+BUF1       = $0500
+BUF2       = $0600
+BUF3       = $0700
+
+Reset:
+        lda #%00000100
+        sta GPU_CTRL
+
+Copy:
+        ; rom -> ram, two pages
+        lda <BUF0
+        sta PALETTE_ST
+        lda >BUF0
+        sta PALETTE_ST
+        ldx #$00
+RomLow:
+        lda SRC,x
+        sta PALETTE_DT
+        inx
+        bne RomLow
+RomHigh:
+        lda SRCHI,x
+        sta PALETTE_DT
+        inx
+        bne RomHigh
+
+        ; ram -> ram, two pages
+        lda <BUF2
+        sta PALETTE_ST
+        lda >BUF2
+        sta PALETTE_ST
+        ldx #$00
+RamLow:
+        lda BUF0,x
+        sta PALETTE_DT
+        inx
+        bne RamLow
+RamHigh:
+        lda BUF1,x
+        sta PALETTE_DT
+        inx
+        bne RamHigh
+
+        ; ram -> ram backwards
+        lda <BUF0
+        sta PALETTE_ST
+        lda >BUF0
+        sta PALETTE_ST
+        ldx #$ff
+Back:
+        lda BUF3,x
+        sta PALETTE_DT
+        dex
+        bne Back
+        jmp Copy
+
+SRC:
+        .incbin "data/bkg.tex"
+SRCHI:
+        .incbin "data/spr.tex"
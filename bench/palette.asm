@@ -0,0 +1,78 @@
+        .org $7FFF
+
+; PALETTE_DT streaming, the background maps and palettes are rewritten all the time
+
+GPU_CTRL    = $0901
+PALETTE_ST  = $0907
+PALETTE_DT  = $0908
+BKGTEX_P    = $090B
+BKG_PAL_MAP = $2E98
+BKG_TEX_MAP = $3000
+BKG_PALETTE = $33C0
+
+Reset:
+        lda #%00000101
+        sta GPU_CTRL
+
+        lda <BGTEX
+        sta BKGTEX_P
+        lda >BGTEX
+        sta BKGTEX_P
+
+        ldy #$00
+Stream:
+        ; palette map, 4 pages
+        lda <BKG_PAL_MAP
+        sta PALETTE_ST
+        lda >BKG_PAL_MAP
+        sta PALETTE_ST
+        ldx #$00
+PalMap:
+        txa
+        ady
+        and #$03
+        sta PALETTE_DT
+        sta PALETTE_DT
+        sta PALETTE_DT
+        sta PALETTE_DT
+        inx
+        bne PalMap
+
+        ; tile map
+        lda <BKG_TEX_MAP
+        sta PALETTE_ST
+        lda >BKG_TEX_MAP
+        sta PALETTE_ST
+        ldx #$00
+TexMap:
+        lda BGMAP,x
+        ady
+        sta PALETTE_DT
+        sta PALETTE_DT
+        sta PALETTE_DT
+        inx
+        bne TexMap
+
+        ; palettes
+        lda <BKG_PALETTE
+        sta PALETTE_ST
+        lda >BKG_PALETTE
+        sta PALETTE_ST
+        ldx #$00
+Pal:
+        lda ALLPAL,x
+        ady
+        sta PALETTE_DT
+        inx
+        cmx #32
+        bne Pal
+
+        iny
+        jmp Stream
+
+ALLPAL:
+        .incbin "data/all.pal"
+BGMAP:
+        .incbin "data/bkg.map"
+BGTEX:
+        .incbin "data/bkg.tex"
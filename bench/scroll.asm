@@ -0,0 +1,85 @@
+        .org $7FFF
+
+; scroll every frame plus two raster splits a frame
+
+GPU_CTRL    = $0901
+VBLANK      = $0902
+PALETTE_ST  = $0907
+PALETTE_DT  = $0908
+BKGTEX_P    = $090B
+BKG_PAL_MAP = $2E98
+BKG_TEX_MAP = $3000
+BKG_PALETTE = $33C0
+SCROLL_X    = $3400
+SCROLL_Y    = $3401
+
+Reset:
+        lda VBLANK
+        bie Reset
+
+        lda #%00000101
+        sta GPU_CTRL
+
+        lda <BGTEX
+        sta BKGTEX_P
+        lda >BGTEX
+        sta BKGTEX_P
+
+        ; palette map + tile map + palettes in one port stream
+        lda <BKG_PAL_MAP
+        sta PALETTE_ST
+        lda >BKG_PAL_MAP
+        sta PALETTE_ST
+        ldy #$00
+FillOuter:
+        ldx #$00
+FillInner:
+        txa
+        add #7
+        xor #$3c
+        and #$3f
+        sta PALETTE_DT
+        inx
+        bne FillInner
+        iny
+        cmy #6
+        bne FillOuter
+
+Frame:
+        lda VBLANK
+        bie Frame
+
+        lda SCROLL_X
+        ina
+        sta SCROLL_X
+        lda SCROLL_Y
+        dea
+        sta SCROLL_Y
+
+EndVbl:
+        lda VBLANK
+        bne EndVbl
+
+        ; raster split a few lines into the frame
+        ldx #$00
+Delay:
+        inx
+        cmx #200
+        bne Delay
+        lda SCROLL_X
+        xor #$80
+        sta SCROLL_X
+        ldx #$00
+Delay2:
+        inx
+        cmx #250
+        bne Delay2
+        lda SCROLL_X
+        xor #$80
+        sta SCROLL_X
+        lda #%01100110
+        sta GPU_CTRL
+        jmp Frame
+
+BGTEX:
+        .incbin "data/bkg.tex"
@@ -0,0 +1,131 @@
+        .org $7FFF
+
+; 64 sprites on screen, all of them move every frame
+
+GPU_CTRL    = $0901
+VBLANK      = $0902
+PALETTE_ST  = $0907
+PALETTE_DT  = $0908
+SPRTEX_P    = $0909
+BKGTEX_P    = $090B
+BKG_TEX_MAP = $3000
+BKG_PALETTE = $33C0
+SPR_PALETTE = $33E0
+SPR         = $0300
+SPRY        = $0301
+SPRC        = $0302
+
+Reset:
+        lda VBLANK
+        bie Reset
+
+        lda #%01100011
+        sta GPU_CTRL
+
+        lda <BGTEX
+        sta BKGTEX_P
+        lda >BGTEX
+        sta BKGTEX_P
+        lda <SPRTEX
+        sta SPRTEX_P
+        lda >SPRTEX
+        sta SPRTEX_P
+
+        ; sprite + background palettes
+        lda <BKG_PALETTE
+        sta PALETTE_ST
+        lda >BKG_PALETTE
+        sta PALETTE_ST
+        ldx #$00
+LoadPal:
+        lda ALLPAL,x
+        sta PALETTE_DT
+        lda ALLPAL,x
+        sta PALETTE_DT
+        inx
+        cmx #32
+        bne LoadPal
+
+        ; background map
+        lda <BKG_TEX_MAP
+        sta PALETTE_ST
+        lda >BKG_TEX_MAP
+        sta PALETTE_ST
+        ldx #$00
+LoadMap:
+        lda BGMAP,x
+        sta PALETTE_DT
+        inx
+        cmx #64
+        bne LoadMap
+
+        ; 64 sprites, byte 2 (ctrl) forced visible
+        lda <SPR
+        sta PALETTE_ST
+        lda >SPR
+        sta PALETTE_ST
+        ldx #$00
+FillSpr:
+        txa
+        and #3
+        cmp #2
+        bne NotCtrl
+        txa
+        aor #1
+        jmp PutSpr
+NotCtrl:
+        cmp #3
+        bne NotTex
+        txa
+        rol
+        rol
+        and #3
+        jmp PutSpr
+NotTex:
+        txa
+        rol
+        xor #$5a
+PutSpr:
+        sta PALETTE_DT
+        inx
+        bne FillSpr
+
+Frame:
+        lda VBLANK
+        bie Frame
+
+        ; move every sprite one pixel right and one down
+        ldx #$00
+Move:
+        lda #$03
+        sta PALETTE_ST
+        txa
+        sta PALETTE_ST
+        lda SPR,x
+        ina
+        sta PALETTE_DT
+        lda SPRY,x
+        add #1
+        sta PALETTE_DT
+        lda SPRC,x
+        xor #%00010110
+        sta PALETTE_DT
+        inx
+        inx
+        inx
+        inx
+        bne Move
+
+EndVbl:
+        lda VBLANK
+        bne EndVbl
+        jmp Frame
+
+ALLPAL:
+        .incbin "data/all.pal"
+BGMAP:
+        .incbin "data/bkg.map"
+BGTEX:
+        .incbin "data/bkg.tex"
+SPRTEX:
+        .incbin "data/spr.tex"
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -23,6 +24,7 @@ typedef unsigned long long u64;
 #define RAM_START     0x0000
 #define STACK_START   0x0800
 #define ROM_START     0x7FFF
+#define ROM_PAGE_SIZE 0x8000
 
 #define strequ(x, y)  !strcmp(x, y)
 
@@ -79,11 +81,13 @@ int get_str_val(const char* str)
     //hex number
     else if(str[0] == '$')
     {
-        if(sscanf(str + 1, "%x", &num) != 1) { return -1; }
+        unsigned int hex = 0;
+        if(sscanf(str + 1, "%x", &hex) != 1) { return -1; }
+        num = (int)hex;
     }
     else
     {
-        if(sscanf(str, "%u", &num) != 1) { return -1; }
+        if(sscanf(str, "%d", &num) != 1) { return -1; }
     }
     
     return num;
@@ -107,8 +111,11 @@ void decompile(std::string source_path, std::string output_path)
     u8* buffer = (u8*)malloc(size);
     fread(buffer, sizeof(u8), size, in);
     
+    //skip header
+    u64 start = size >= 4 && buffer[0] == 'C' && buffer[1] == 'M' && buffer[2] == 'U' ? 4 : 0;
+    
     //process instructions
-    for(u64 i = 0; i < size; )
+    for(u64 i = start; i < size; )
     {
         u8 op       = buffer[i];
         
@@ -147,6 +154,65 @@ void decompile(std::string source_path, std::string output_path)
     fclose(out);
 }
 
+/*****************/
+//TRACE
+/*****************/
+
+//prints execution trace of the emulator, oldest record first
+void print_trace(std::string trace_path, std::string output_path)
+{
+    //open files
+    FILE* in  = fopen(trace_path.c_str(), "rb");
+    FILE* out = fopen(output_path.c_str(), "w");
+    
+    if(in == NULL || out == NULL) { printf("error: cannot open files\n"); return; }
+    
+    //check header
+    trace_header_t header;
+    
+    if(fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, "CMT", 3) != 0 ||
+       header.version != TRACE_VERSION || header.capacity == 0)
+    {
+        printf("error: %s is not a trace file\n", trace_path.c_str()); fclose(in); fclose(out); return;
+    }
+    
+    //read the ring
+    std::vector<trace_record_t> ring(header.capacity);
+    
+    if(fread(ring.data(), sizeof(trace_record_t), header.capacity, in) != header.capacity)
+    {
+        printf("error: trace file is cut short\n"); fclose(in); fclose(out); return;
+    }
+    
+    //older records were overwritten
+    u64 first = header.count > header.capacity ? header.count - header.capacity : 0;
+    
+    for(u64 i = first; i < header.count; i++)
+    {
+        const trace_record_t& record = ring[i % header.capacity];
+        u8                    op     = record.op;
+        bool                  known  = op < sizeof(OP_NAMES) / sizeof(OP_NAMES[0]);
+        
+        //instruction
+        char args[16] = "";
+        
+        if(known && OP_MODES[op] == OP_MODE_VAL)     { snprintf(args, sizeof(args), "#$%02x", (u8)record.arg); }
+        if(known && OP_MODES[op] == OP_MODE_ADD)     { snprintf(args, sizeof(args), "$%04x", record.arg); }
+        if(known && OP_MODES[op] == OP_MODE_REL_ADD) { snprintf(args, sizeof(args), "$%04x,%c", record.arg, op == OPRAX_LDA ? 'x' : 'y'); }
+        
+        fprintf(out, "%12llu  %04x  %s %-8s", record.cycles, record.pc, known ? OP_NAMES[op] : "???", args);
+        
+        //registers before the instruction
+        fprintf(out, "(A: %u) (X: %u) (Y: %u) (SP: %u) (flags: ", record.A, record.X, record.Y, record.SP);
+        for(int bit = 7; bit >= 0; bit--) { fputc(GET_BIT(record.flags, bit) ? '1' : '0', out); }
+        fprintf(out, ")\n");
+    }
+    
+    //cleanup
+    fclose(in);
+    fclose(out);
+}
+
 /*****************/
 //COMPILE
 /*****************/
@@ -174,7 +240,7 @@ void compile(std::string source_path, std::string output_path)
     
 #define add_opcode(op)\
         program.push_back(op);\
-        if(op.op_mode == OP_MODE_ADD || op.op_mode == OP_MODE_UNRESOLVED_ADD)\
+        if(op.op_mode == OP_MODE_ADD || op.op_mode == OP_MODE_REL_ADD || op.op_mode == OP_MODE_UNRESOLVED_ADD)\
         {\
             current_byte += 3;\
         }\
@@ -464,6 +530,7 @@ void compile(std::string source_path, std::string output_path)
                                     address = con_id_pos->second;
                                     if(fetch_high_low ==  1) { op.argument = (u8)(address >> 8); }
                                     if(fetch_high_low == -1) { op.argument = (u8)(address >> 0); }
+                                    if(fetch_high_low ==  0) { op.argument = (u16)address; }
                                 }
                                 //found identificator in labels
                                 else if(lab_id_pos != labels.end())
@@ -471,6 +538,7 @@ void compile(std::string source_path, std::string output_path)
                                     address = lab_id_pos->second;
                                     if(fetch_high_low ==  1) { op.argument = (u8)(address >> 8); }
                                     if(fetch_high_low == -1) { op.argument = (u8)(address >> 0); }
+                                    if(fetch_high_low ==  0) { op.argument = (u16)address; }
                                     
                                 }
                                 //haven't found anything, put it to unresolved
@@ -657,8 +725,15 @@ void compile(std::string source_path, std::string output_path)
     //process opcodes and write final executable
     FILE* out = fopen(output_path.c_str(), "wb");
     
-    //TODO: write header
-    //TODO: calculate number of pages
+    //write header, 'C', 'M', 'U' + number of pages
+    u32 pages = current_byte == 0 ? 1 : (current_byte + ROM_PAGE_SIZE - 1) / ROM_PAGE_SIZE;
+    
+    if(pages > 0xFF) { printf("error: program does not fit into 255 pages\n"); exit(1); }
+    
+    fputc('C', out);
+    fputc('M', out);
+    fputc('U', out);
+    fputc((u8)pages, out);
     
     for(u32 i = 0; i < program.size(); i++)
     {
@@ -736,6 +811,7 @@ void compile(std::string source_path, std::string output_path)
             }
             //write instruction with address argument
             case OP_MODE_ADD:
+            case OP_MODE_REL_ADD:
             {
                 fputc(op.opcode, out);
                 fputc((u8)(op.argument >> 8), out);
@@ -756,12 +832,12 @@ int main(int argc, char* argv[])
 {
     if(argc < 3)
     {
-        printf("usage: com [-c/-d source] [-o output]\n"); exit(1);
+        printf("usage: com [-c/-d source] [-t trace] [-o output]\n"); exit(1);
     }
     
     std::string input;
     std::string output = "out";
-    enum { NONE, COMPILE, DECOMPILE } mode = NONE;
+    enum { NONE, COMPILE, DECOMPILE, TRACE } mode = NONE;
     
     for(int i = 0; i < argc; i++)
     {
@@ -777,6 +853,12 @@ int main(int argc, char* argv[])
             input = argv[i + 1];
             mode  = DECOMPILE;
         }
+        else if(strequ(argv[i], "-t"))
+        {
+            if(i + 1 == argc) { printf("error: missing trace file\n"); exit(1); }
+            input = argv[i + 1];
+            mode  = TRACE;
+        }
         else if(strequ(argv[i], "-o"))
         {
             if(i + 1 == argc) { printf("error: missing source file\n"); exit(1); }
@@ -786,7 +868,7 @@ int main(int argc, char* argv[])
     
     if(mode == NONE)
     {
-        printf("usage: com [-c/-d source] [-o output]\n"); exit(1);
+        printf("usage: com [-c/-d source] [-t trace] [-o output]\n"); exit(1);
     }
     else if(mode == COMPILE)
     {
@@ -800,4 +882,10 @@ int main(int argc, char* argv[])
         
         decompile(input, output);
     }
+    else if(mode == TRACE)
+    {
+        if(output == "out") { output += ".txt"; }
+        
+        print_trace(input, output);
+    }
 }
@@ -1,11 +1,56 @@
+//the JIT targets x86-64 System V hosts and runs whole blocks, profiling needs single instructions
+#if defined(CPU_JIT) && (!defined(__x86_64__) || defined(_WIN32) || defined(PROFILE))
+#undef CPU_JIT
+#endif
+
+//ROMs and traces are memory mapped files on POSIX hosts, other hosts keep them in memory
+#ifndef _WIN32
+#define FILE_MMAP
+#endif
+
+#if defined(CPU_JIT) || defined(FILE_MMAP)
+#define _DEFAULT_SOURCE //mmap
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <ctype.h>
 #include <unistd.h>
 
 #include <SDL2/SDL.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+//the AVX2 kernel is compiled with a target attribute and only used if the cpu has AVX2
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define EXPAND_AVX2
+#endif
+
+#ifdef CPU_JIT
+#include <stddef.h>
+#endif
+
+#if defined(CPU_JIT) || defined(FILE_MMAP)
+#include <sys/mman.h>
+#endif
+
+#ifdef FILE_MMAP
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+//per thread storage
+#ifdef _MSC_VER
+#define EMU_THREAD __declspec(thread)
+#else
+#define EMU_THREAD __thread
+#endif
+
 typedef unsigned char  u8;
 typedef unsigned short u16;
 typedef unsigned int   u32;
@@ -30,6 +75,7 @@ typedef unsigned long long u64;
 #define PALETTE_DT    0x0908 //0x0001 byte
 #define SPRTEX_P      0x0909 //0x0002 bytes
 #define BKGTEX_P      0x090B //0x0002 bytes
+#define CART_BANK     0x090D //0x0001 byte, ROM page mapped at ROM_START
 #define BKG_PAL_MAP   0x2E98 //0x0168 bytes
 #define BKG_TEX_MAP   0x3000 //0x03C0 bytes
 #define BKG_PALETTE   0x33C0 //0x0020 bytes
@@ -45,6 +91,10 @@ typedef unsigned long long u64;
 #define SCR_WIDTH     256
 #define SCR_HEIGHT    240
 
+//1 gpu tick = 1 pixel, vblank lasts a third of the visible frame
+#define GPU_VISIBLE_TICKS (SCR_WIDTH * SCR_HEIGHT)
+#define GPU_FRAME_TICKS   (GPU_VISIBLE_TICKS + GPU_VISIBLE_TICKS / 3)
+
 #include "ops.h"
 
 /*****************/
@@ -66,6 +116,12 @@ enum MEM_ACCESS_MODE
     WRITE = 1
 };
 
+enum WATCH_MODE
+{
+    WATCH_READ  = 1,
+    WATCH_WRITE = 2
+};
+
 enum CONTROLLER_KEYS_0
 {
     KEY_DOWN = 0,
@@ -108,21 +164,20 @@ static u32 VGA_PALLETTE[64] =
 };
 
 //prototypes
-void put_pix   (u32 x, u32 y, u32 index);
-u8   mem_access(u8 mode, u16 address, u8 value);
-#define WB(address, value) mem_access(WRITE, address, value)
-#define RB(address)        mem_access(READ,  address, 0)
-
-//RAM
-static u8     RAM[0x10000];
-static u8     cart_page     = 0;
-static u8     cart_page_max = 0;
-static u8*    cart_buffer   = NULL;
+u8   mem_io      (u8 mode, u16 address, u8 value);
+void gpu_catch_up();
+u8   movie_frame ();
+void debug_map   ();
+void debug_watch (u8 mode, u16 address, u8 value);
 
 /*****************/
-//GPU
+//MACHINE
 /*****************/
 
+//page table granularity
+#define PAGE_SIZE  0x100
+#define PAGE_COUNT 0x100
+
 #define SPRITE_WIDTH  8
 #define SPRITE_HEIGHT 8
 typedef struct
@@ -168,7 +223,284 @@ typedef struct
     u8 default_background_color;
     
     u32 tick_index;
-} gpu_t; static gpu_t gpu;
+    u32 render_index; //next pixel to be drawn
+    u64 frames;       //number of finished frames
+    u64 cycles;       //cpu cycle the gpu has caught up to
+} gpu_t;
+
+//sprites covering one scanline, in draw order
+typedef struct
+{
+    u32 y;     //scanline the list was built for (SCR_HEIGHT = none)
+    u32 count;
+    
+    struct
+    {
+        u8 x;
+        u8 palette;
+        u8 row[SPRITE_WIDTH]; //color indices, horizontal flip already applied
+    } entries[NUM_SPRITES];
+} sprite_list_t;
+
+//pre-expanded 8x8 tiles of one texture, one color index per byte
+typedef struct
+{
+    u16 base;         //texture pointer the tiles were decoded from
+    u8  valid[256];
+    u8  decoded[256][SPRITE_WIDTH * SPRITE_HEIGHT];
+} tile_cache_t;
+
+//big endian CPU
+typedef struct
+{
+    //registers
+    u8 A, X, Y, SP;
+    u8 flags; //zero, overflow and underflow are kept lazily below, use cpu_get_flags()
+
+    u16 PC;
+    
+    u64 cycles;       //number of executed cycles
+    u64 instructions; //number of executed instructions, not part of save states
+    
+    //last flag producing results, evaluated only when a branch or a dump reads them
+    u8  zero;      //last result, zero flag = (zero == 0)
+    u16 overflow;  //last x + y, overflow flag = carry into bit 8
+    u16 underflow; //last x - y, underflow flag = borrow into the high byte
+} cpu_t;
+
+//predecoded instruction
+typedef struct
+{
+    u8  op;
+    u8  cycles;
+    u16 arg;  //operand, 8-bit value or 16-bit address
+    u16 pc;   //address of the operation code
+    u16 next; //address of the following instruction
+} ins_t;
+
+//pseudo instruction in front of a breakpoint, next == pc tells it from a 0xFF byte of the program
+#define OP_DEBUG 0xFF
+
+//straight-line run of instructions ending with a jump, branch, call or return
+#define BLOCK_MAX_INS   32
+#define BLOCK_MAX_BYTES (BLOCK_MAX_INS * 3)
+#define BLOCK_COUNT     2048
+
+typedef struct
+{
+    u16   start, end; //covered bytes [start, end)
+    u32   length;     //number of instructions
+    u32   cycles;     //cycles of all instructions
+    ins_t ins[BLOCK_MAX_INS];
+#ifdef CPU_JIT
+    u8*   code;       //native translation
+    u8    no_jit;     //cannot be translated
+    u8    runs;       //interpreted runs before translation
+#endif
+} block_t;
+
+//blocks are looked up by their start address
+//pages blocks were decoded from are written through mem_io so the writes can invalidate them
+typedef struct
+{
+    u16     map[0x10000];           //block index + 1, 0 = not decoded
+    u8      code_pages[PAGE_COUNT];
+    u32     count;
+    block_t blocks[BLOCK_COUNT];
+    block_t scratch;                //single instruction from the I/O page, never cached
+} block_cache_t;
+
+#ifdef CPU_JIT
+typedef struct
+{
+    u8* base;
+    u32 used;
+    u8* p;       //emit position
+    u32 charged; //cycles of the running block already given to the gpu
+    u8* enter;   //loads the guest registers and jumps to a block, void enter(u8* code)
+    u8* leave;   //stores the guest registers and returns from enter
+    u32 stubs;   //bytes of enter and leave at the start of the code space
+} jit_t;
+#endif
+
+#ifdef PROFILE
+//execution counts and cycles, see PROFILER
+typedef struct
+{
+    u64 op_count [256];
+    u64 op_cycles[256];
+    u64 pc_count [0x10000];
+    u64 pc_cycles[0x10000];
+    u8  pc_op    [0x10000]; //opcode last executed at the address
+    
+    u64 vblank_polls;       //reads of GPU_VBLANK
+    u64 vblank_wait;        //cycles between back to back reads
+    u64 vblank_last;        //cycle of the last read
+} profile_t;
+#endif
+
+//ring of executed instructions, see TRACE
+typedef struct
+{
+    trace_header_t* header;  //header followed by the records
+    trace_record_t* records;
+    u64             length;  //bytes of header and records
+    u32             mask;    //capacity - 1
+    u8              on;      //recording, toggled at runtime
+} trace_t;
+
+//breakpoints and watchpoints, see DEBUGGER
+#define DEBUG_WATCHES 16
+
+//why the console opens
+#define DEBUG_USER  1 //-debug or F9
+#define DEBUG_STEP  2 //finished step
+#define DEBUG_BREAK 3 //breakpoint instruction
+#define DEBUG_WATCH 4 //watched access
+
+typedef struct
+{
+    u16 start, end; //watched bytes [start, end]
+    u8  mode;       //WATCH_READ | WATCH_WRITE
+} watch_t;
+
+typedef struct
+{
+    u8      breakpoints[0x10000];    //1 = stop before the instruction at the address
+    watch_t watches[DEBUG_WATCHES];
+    u32     watch_count;
+    u8      watch_pages[PAGE_COUNT]; //modes watched somewhere in the page
+    
+    u8      stop;  //DEBUG_*, open the console before the next instruction
+    u8      skip;  //resume past the breakpoint the cpu stopped on
+    u64     steps; //instructions left to step
+} debug_t;
+
+//snapshots of the last minutes, see REWIND
+typedef struct rewind_s rewind_t;
+
+//recorded or replayed controller input, see MOVIES
+typedef struct
+{
+    u8  mode;
+    u64 rom_hash;
+    u32 count;    //frames
+    u32 capacity;
+    u8* pads;     //MOVIE_PADS bytes per frame
+} movie_t;
+
+//one emulated machine
+typedef struct
+{
+    cpu_t cpu;
+    u64   cpu_deadline; //cpu_run stops once cpu.cycles reaches this
+    
+    //RAM
+    u8    RAM[0x10000];
+    
+    //cartridge, the ROM window shows one page of the image at a time
+    u8    cart_page;     //selected page, see CART_BANK
+    u8    cart_page_max; //number of pages
+    u8*   cart_buffer;   //whole image, pages back to back, owned by the caller of emu_load
+    
+    //page table
+    //plain memory pages point straight to their backing storage,
+    //NULL pages (I/O, partially mapped and watched pages) go through mem_io
+    u8*   read_pages [PAGE_COUNT];
+    u8*   write_pages[PAGE_COUNT];
+    
+    gpu_t         gpu;
+    sprite_list_t sprite_list; //sprites covering one scanline
+    tile_cache_t  bkg_tiles, spr_tiles;
+    u8*           pixels;      //indexed framebuffer, the gpu writes palette indices, see PALETTE EXPANSION
+    
+    block_cache_t block_cache;
+#ifdef CPU_JIT
+    jit_t         jit;
+#endif
+#ifdef PROFILE
+    profile_t     profile;
+#endif
+    trace_t       trace;
+    debug_t       debug;
+    movie_t       movie;
+    rewind_t*     rewind_data; //allocated by frontends that rewind
+    FILE*         output;      //text the program prints with INT 0x10, stdout or the batch job's summary
+} emu_t;
+
+//machine of the calling thread, emu_init creates it and everything below works on it
+//threads run their own machines side by side, see BATCH RUNNER
+static EMU_THREAD emu_t* emu = NULL;
+
+//machine state keeps the names it had as globals
+#define cpu           (emu->cpu)
+#define cpu_deadline  (emu->cpu_deadline)
+#define RAM           (emu->RAM)
+#define cart_page     (emu->cart_page)
+#define cart_page_max (emu->cart_page_max)
+#define cart_buffer   (emu->cart_buffer)
+#define read_pages    (emu->read_pages)
+#define write_pages   (emu->write_pages)
+#define gpu           (emu->gpu)
+#define sprite_list   (emu->sprite_list)
+#define bkg_tiles     (emu->bkg_tiles)
+#define spr_tiles     (emu->spr_tiles)
+#define pixels        (emu->pixels)
+#define block_cache   (emu->block_cache)
+#ifdef CPU_JIT
+#define jit           (emu->jit)
+#endif
+#ifdef PROFILE
+#define profile       (emu->profile)
+#endif
+#define trace         (emu->trace)
+#define debug         (emu->debug)
+#define movie         (emu->movie)
+#define rewind_ring   (*emu->rewind_data)
+#define output        (emu->output)
+
+static u8 open_bus[PAGE_SIZE]; //unmapped pages read as 0, shared by all machines
+
+//ram access
+static inline u8 mem_access(u8 mode, u16 address, u8 value)
+{
+    if(mode)
+    {
+        u8* page = write_pages[address >> 8];
+        if(page) { page[address & 0xFF] = value; return 0; }
+    }
+    else
+    {
+        u8* page = read_pages[address >> 8];
+        if(page) { return page[address & 0xFF]; }
+    }
+    
+    return mem_io(mode, address, value);
+}
+#define WB(address, value) mem_access(WRITE, address, value)
+#define RB(address)        mem_access(READ,  address, 0)
+
+//ROM window byte of the selected cartridge page, the window ends one byte short of 0xFFFF
+static inline u8 cart_read(u16 address)
+{
+    u32 offset = address - ROM_START;
+    
+    return cart_buffer && offset < ROM_PAGE_SIZE ? cart_buffer[ROM_PAGE_SIZE * cart_page + offset] : 0;
+}
+
+//read without side effects, the renderer reads textures through it
+static inline u8 mem_peek(u16 address)
+{
+    u8* page = read_pages[address >> 8];
+    if(page) { return page[address & 0xFF]; }
+    
+    return address >= ROM_START ? cart_read(address) : RAM[address];
+}
+
+/*****************/
+//GPU
+/*****************/
+
 
 //bit field operations
 static inline u8 bit(u8* array, u32 bit_index)
@@ -183,168 +515,592 @@ static inline u8 get_triplet(u8* array, u32 bit_index)
            (bit(array, bit_index + 2) << 0);
 }
 
-//process 1 pixel
-void gpu_exec()
+//is memory at address read by the renderer
+static inline u8 gpu_reads(u16 address)
+{
+    return (address >= BKG_PAL_MAP && address <= SCROLL_Y)                      ||
+           (address >= gpu.sdata   && address <  gpu.sdata + NUM_SPRITES * 4) ||
+           (u16)(address - gpu.bkgtex_p) < 256 * 16                           ||
+           (u16)(address - gpu.sprtex_p) < 256 * 16;
+}
+
+//expand 2bpp planar tile (8 low plane rows, 8 high plane rows)
+//into 64 color indices
+static void tile_decode(u8* out, u16 address)
+{
+    u8 raw[16];
+    for(u32 i = 0; i < 16; i++) { raw[i] = mem_peek(address + i); }
+    
+#ifdef __SSE2__
+    const __m128i mask = _mm_set_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+                                      0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80);
+    const __m128i one  = _mm_set1_epi8(1);
+    const __m128i two  = _mm_set1_epi8(2);
+    
+    __m128i tile = _mm_loadu_si128((const __m128i*)raw);
+    
+    //broadcast every plane byte over 8 lanes, two rows per register
+    __m128i lo  = _mm_unpacklo_epi8(tile, tile);
+    __m128i hi  = _mm_unpackhi_epi8(tile, tile);
+    __m128i lo4[2] = { _mm_unpacklo_epi16(lo, lo), _mm_unpackhi_epi16(lo, lo) };
+    __m128i hi4[2] = { _mm_unpacklo_epi16(hi, hi), _mm_unpackhi_epi16(hi, hi) };
+    
+    for(u32 i = 0; i < 4; i++)
+    {
+        __m128i l = i & 1 ? _mm_unpackhi_epi32(lo4[i / 2], lo4[i / 2]) : _mm_unpacklo_epi32(lo4[i / 2], lo4[i / 2]);
+        __m128i h = i & 1 ? _mm_unpackhi_epi32(hi4[i / 2], hi4[i / 2]) : _mm_unpacklo_epi32(hi4[i / 2], hi4[i / 2]);
+        
+        //pixel bit set -> 0xFF, then merge both planes
+        l = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(l, mask), mask), one);
+        h = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(h, mask), mask), two);
+        
+        _mm_storeu_si128((__m128i*)(out + i * 16), _mm_or_si128(l, h));
+    }
+#else
+    for(u32 y = 0; y < SPRITE_HEIGHT; y++)
+    {
+        for(u32 x = 0; x < SPRITE_WIDTH; x++)
+        {
+            out[y * SPRITE_WIDTH + x] = (raw[y] >> (7 - x) & 1) + (raw[y + 8] >> (7 - x) & 1) * 2;
+        }
+    }
+#endif
+}
+
+//get decoded tile, decode it on first use
+static inline const u8* tile_get(tile_cache_t* cache, u16 base, u8 id)
+{
+    //texture pointer changed, drop every tile
+    if(cache->base != base)
+    {
+        cache->base = base;
+        memset(cache->valid, 0, sizeof(cache->valid));
+    }
+    
+    if(!cache->valid[id])
+    {
+        tile_decode(cache->decoded[id], base + id * 16);
+        cache->valid[id] = 1;
+    }
+    
+    return cache->decoded[id];
+}
+
+//drop decoded tile containing address
+static inline void tile_invalidate(tile_cache_t* cache, u16 address)
+{
+    u16 offset = address - cache->base;
+    
+    if(offset < 256 * 16) { cache->valid[offset / 16] = 0; }
+}
+
+//collect visible sprites covering scanline y
+static void gpu_eval_sprites(u32 y)
 {
-    gpu.tick_index = (gpu.tick_index + 1) % ((SCR_WIDTH * SCR_HEIGHT) + ((SCR_WIDTH * SCR_HEIGHT) / 3));
-    gpu.vblank     =  gpu.tick_index >= (SCR_WIDTH * SCR_HEIGHT);
+    sprite_list.y     = y;
+    sprite_list.count = 0;
     
-    //if vblank is not active
-    //start drawing
-    if(!gpu.vblank)
+    for(u32 i = 0; i < NUM_SPRITES; i++)
     {
-        //pixel coordinates
-        u8 pix_x     = gpu.tick_index % SCR_WIDTH;
-        u8 pix_y     = gpu.tick_index / SCR_WIDTH;
+        u8 sp_y    = RAM[(gpu.sdata + i * 4 + 1) % RAM_SIZE];
+        u8 sp_ctrl = RAM[(gpu.sdata + i * 4 + 2) % RAM_SIZE];
+        
+        //if sprite is invisible or does not cover the scanline
+        if(!(sp_ctrl & 1) || y < sp_y || y >= (u32)sp_y + SPRITE_HEIGHT) { continue; }
+        
+        u8 sp_x      = RAM[(gpu.sdata + i * 4 + 0) % RAM_SIZE];
+        u8 sp_tex_id = RAM[(gpu.sdata + i * 4 + 3) % RAM_SIZE];
         
-    /* background processing */
+        //calculate row offset and get the texture row
+        u8        y_off = sp_ctrl & 4 ? SPRITE_HEIGHT - (y - sp_y) - 1 : y - sp_y;
+        const u8* row   = tile_get(&spr_tiles, gpu.sprtex_p, sp_tex_id) + y_off * SPRITE_WIDTH;
         
-        //background scroll
-        u8 scrolled_pix_x = pix_x - RAM[SCROLL_X];
-        u8 scrolled_pix_y = pix_y - RAM[SCROLL_Y];
+        u8* entry_row = sprite_list.entries[sprite_list.count].row;
+        for(u32 x = 0; x < SPRITE_WIDTH; x++)
+        {
+            entry_row[x] = row[sp_ctrl & 2 ? SPRITE_WIDTH - x - 1 : x];
+        }
         
-        //get background tile index coordinates
-        u8 bg_x = scrolled_pix_x / 8;
-        u8 bg_y = scrolled_pix_y / 8;
+        sprite_list.entries[sprite_list.count].x       = sp_x;
+        sprite_list.entries[sprite_list.count].palette = ((sp_ctrl >> 3) & 0x7) * 4;
+        sprite_list.count++;
+    }
+}
+
+//draw pixels [x0, x1) of scanline y
+static void gpu_draw_span(u32 y, u32 x0, u32 x1)
+{
+    u8* line = pixels + y * SCR_WIDTH;
+    
+/* background processing */
+    
+    //background scroll
+    u8 scrolled_pix_y = y - RAM[SCROLL_Y];
+    
+    //get background tile row and pixel offset in tile
+    u8 bg_y  = scrolled_pix_y / 8;
+    u8 y_off = scrolled_pix_y - bg_y * 8;
+    
+    //process one background tile at a time
+    for(u32 x = x0; x < x1; )
+    {
+        u8 scrolled_pix_x = x - RAM[SCROLL_X];
         
-        //get pixel and tile offset
+        u8 bg_x  = scrolled_pix_x / 8;
         u8 x_off = scrolled_pix_x - bg_x * 8;
-        u8 y_off = scrolled_pix_y - bg_y * 8;
+        
+        //pixels of this tile inside the span
+        u32 run = 8u - x_off;
+        if(run > x1 - x) { run = x1 - x; }
         
         //get tile index in background texture map
         u8 bg_tex_map_index = RAM[BKG_TEX_MAP + bg_x + bg_y * 32];
-        //get tile color palette in 3 bit array background palette map
-        //TODO: check if this is right
-        u8 bg_pal_map_index = get_triplet(RAM + BKG_PAL_MAP, (bg_x + bg_y * 32) * 3) * 4;
-        
-        u16 tex_offset;
-        u8  pix_color;
         
         //if tile is not zero, draw tile
         if(bg_tex_map_index != 0)
         {
-            tex_offset = gpu.bkgtex_p + bg_tex_map_index * 16;
-            pix_color = (RAM[tex_offset + y_off + 0] >> (7 - x_off) & 1) +
-                        (RAM[tex_offset + y_off + 8] >> (7 - x_off) & 1) * 2;
+            //get tile color palette in 3 bit array background palette map
+            u8  bg_pal_map_index = get_triplet(RAM + BKG_PAL_MAP, (bg_x + bg_y * 32) * 3) * 4;
+            
+            //get the decoded tile row
+            const u8* row     = tile_get(&bkg_tiles, gpu.bkgtex_p, bg_tex_map_index) + y_off * 8 + x_off;
+            const u8* palette = RAM + BKG_PALETTE + bg_pal_map_index;
             
-            put_pix(pix_x, pix_y, RAM[BKG_PALETTE + pix_color + bg_pal_map_index]);
+            for(u32 i = 0; i < run; i++) { line[x + i] = palette[row[i]]; }
         }
         //else draw default background color
         else
         {
-            //draw background color
-            put_pix(pix_x, pix_y, gpu.default_background_color);
+            memset(line + x, gpu.default_background_color, run);
         }
         
-    /* sprite processing */
-        for(u32 i = 0; i < NUM_SPRITES; i++)
+        x += run;
+    }
+    
+/* sprite processing */
+    
+    //evaluate sprites once per scanline
+    if(sprite_list.y != y) { gpu_eval_sprites(y); }
+    
+    //later sprites are drawn over earlier ones
+    for(u32 i = 0; i < sprite_list.count; i++)
+    {
+        u8        sp_x    = sprite_list.entries[i].x;
+        const u8* row     = sprite_list.entries[i].row;
+        const u8* palette = RAM + SPR_PALETTE + sprite_list.entries[i].palette;
+        
+        //sprite pixels inside the span
+        u32 start = sp_x > x0 ? sp_x : x0;
+        u32 end   = (u32)sp_x + SPRITE_WIDTH < x1 ? (u32)sp_x + SPRITE_WIDTH : x1;
+        
+        for(u32 x = start; x < end; x++)
         {
-            u8 sp_x      = RAM[(gpu.sdata + i * 4 + 0) % RAM_SIZE];
-            u8 sp_y      = RAM[(gpu.sdata + i * 4 + 1) % RAM_SIZE];
-            u8 sp_ctrl   = RAM[(gpu.sdata + i * 4 + 2) % RAM_SIZE];
-            u8 sp_tex_id = RAM[(gpu.sdata + i * 4 + 3) % RAM_SIZE];
+            u8 pix_color = row[x - sp_x];
             
-            if(sp_ctrl & 1                 && //if sprite visible
-               
-               pix_x >= sp_x               && //if
-               pix_x < sp_x + SPRITE_WIDTH && //pixel coordinates
-               pix_y >= sp_y               && //are within
-               pix_y < sp_y + SPRITE_HEIGHT)  //sprite bounding box
-            {
-                //calculate pixel offset
-                x_off = sp_ctrl & 2 ? SPRITE_WIDTH  - (pix_x - sp_x) - 1 : pix_x - sp_x;
-                y_off = sp_ctrl & 4 ? SPRITE_HEIGHT - (pix_y - sp_y) - 1 : pix_y - sp_y;
-                //get texture offset
-                tex_offset = (gpu.sprtex_p + sp_tex_id * 16);
-                
-                //get pixel color from texture
-                pix_color = (RAM[tex_offset + y_off + 0] >> (7 - x_off) & 1) +
-                            (RAM[tex_offset + y_off + 8] >> (7 - x_off) & 1) * 2;
-                
-                //if not zero, draw the pixel with sprite palette
-                if(pix_color != 0)
-                {
-                    put_pix(pix_x, pix_y, RB(SPR_PALETTE + pix_color + ((sp_ctrl >> 3) & 0x7) * 4));
-                }
-            }
+            //if not zero, draw the pixel with sprite palette
+            if(pix_color != 0) { line[x] = palette[pix_color]; }
         }
     }
 }
 
-/*****************/
-//CPU + RAM ACCESS
-/*****************/
+//draw pending pixels up to pixel index end (exclusive)
+static void gpu_draw(u32 end)
+{
+    while(gpu.render_index < end)
+    {
+        u32 y  = gpu.render_index / SCR_WIDTH;
+        u32 x0 = gpu.render_index % SCR_WIDTH;
+        u32 x1 = end - y * SCR_WIDTH < SCR_WIDTH ? end - y * SCR_WIDTH : SCR_WIDTH;
+        
+        gpu_draw_span(y, x0, x1);
+        
+        gpu.render_index = y * SCR_WIDTH + x1;
+        
+        //last pixel of the frame, let the frontend see it
+        if(gpu.render_index == GPU_VISIBLE_TICKS) { gpu.frames++; cpu_deadline = 0; }
+    }
+}
 
-//big endian CPU
-typedef struct
+//draw every pixel the beam has already passed
+//must be called before anything the renderer reads changes
+static void gpu_sync()
 {
-    //registers
-    u8 A, X, Y, SP;
-    u8 flags;
+    gpu_catch_up();
+    
+    if(gpu.tick_index < GPU_VISIBLE_TICKS) { gpu_draw(gpu.tick_index + 1); }
+    
+    //sprites of the current scanline may change
+    sprite_list.y = SCR_HEIGHT;
+}
 
-    u16 PC;
-} cpu_t; static cpu_t cpu;
+//memory read by the renderer is about to change
+static void gpu_touch(u16 address)
+{
+    gpu_sync();
+    tile_invalidate(&bkg_tiles, address);
+    tile_invalidate(&spr_tiles, address);
+}
 
+//cpu cycle at which the current frame is finished, the only gpu event the cpu has to stop for
+//the frame ends when the beam reaches its last visible pixel
+//everything else the cpu can observe goes through mem_io, which catches the gpu up first
+static u64 gpu_next_event()
+{
+    u32 end = gpu.render_index < GPU_VISIBLE_TICKS ? GPU_VISIBLE_TICKS - 1 : GPU_FRAME_TICKS + GPU_VISIBLE_TICKS - 1;
+    
+    return gpu.cycles + (end - gpu.tick_index + 2) / 3;
+}
 
-//ram access
-u8 mem_access(u8 mode, u16 address, u8 value)
+//advance gpu by n ticks (1 tick = 1 pixel)
+//whole scanlines are drawn once the beam leaves them
+void gpu_run(u32 ticks)
 {
-    //ram + palettes + map access
-    if((address >= RAM_START   && address < RAM_SIZE)    ||
-       (address >= BKG_PAL_MAP && address < BKG_TEX_MAP) ||
-       (address >= BKG_TEX_MAP && address < SCROLL_X)    ||
-       (address >= SCROLL_X    && address <= SCROLL_Y))
-    {
-        if(mode) { RAM[address] = value; return 0; } else { return RAM[address]; };
-    }
-    //gpu control
-    else if(address == GPU_CTRL)
-    {
-        if(mode)
-        {
-            gpu.ctrl  = value;
-            //if(gpu.ctrl & 1) { gpu.sram = 0x2000; gpu.bram = 0x1000; }
-            //else             { gpu.sram = 0x1000; gpu.bram = 0x2000; }
-            switch(gpu.ctrl & 7)
-            {
-                case 0: { gpu.default_background_color = 13; break; } //black
-                case 1: { gpu.default_background_color = 46; break; } //white
-                case 2: { gpu.default_background_color = 21; break; } //red
-                case 3: { gpu.default_background_color = 41; break; } //green
-                case 4: { gpu.default_background_color = 33; break; } //blue
-                case 5: { gpu.default_background_color = 47; break; } //light blue
-                case 6: { gpu.default_background_color = 53; break; } //yellow
-                case 7: { gpu.default_background_color = 34; break; } //magenta
-            }
-            gpu.sdata = (gpu.ctrl << 3) & 0x0700;
-            return 0;
-        } else { return gpu.ctrl; }
-    }
-    //gpu vblank
-    else if(address == GPU_VBLANK)
-    {
-        //writes turn to reads
-        return gpu.vblank;
-    }
-    //controllers
-    else if(address >= CONTROLLER0 && address <= CONTROLLER1 + 1)
-    {
-        //writes turn to reads
-        return RAM[address];
-    }
-    else if (address >= ROM_START && address <= 0xFFFF)
+    while(ticks > 0)
     {
-        if(cart_page == 0)
+        u32 left = GPU_FRAME_TICKS - gpu.tick_index;
+        
+        if(ticks < left)
         {
-            return RAM[address];
+            gpu.tick_index += ticks;
+            ticks           = 0;
         }
+        //finish the frame and start a new one
         else
         {
-            return cart_buffer[address + ROM_PAGE_SIZE * (cart_page - 1)];
+            gpu_draw(GPU_VISIBLE_TICKS);
+            
+            ticks           -= left;
+            gpu.tick_index   = 0;
+            gpu.render_index = 0;
+            sprite_list.y    = SCR_HEIGHT;
         }
-    }
-    //palette start index
-    else if(address == PALETTE_ST)
+        
+        //draw finished scanlines
+        if(gpu.tick_index < GPU_VISIBLE_TICKS)
+        {
+            gpu_draw((gpu.tick_index + 1) / SCR_WIDTH * SCR_WIDTH);
+        }
+        else
+        {
+            gpu_draw(GPU_VISIBLE_TICKS);
+        }
+    }
+    
+    gpu.vblank = gpu.tick_index >= GPU_VISIBLE_TICKS;
+}
+
+/*****************/
+//PROFILER
+/*****************/
+
+//built with -DPROFILE only, other builds have no trace of it
+//the interpreter counts every instruction at its address with the cycles from OP_CYCLES,
+//reads of GPU_VBLANK less than PROFILE_POLL_GAP cycles apart are a poll loop waiting for the gpu
+#ifdef PROFILE
+
+#define PROFILE_POLL_GAP 16
+#define PROFILE_TOP      32 //addresses in the table, the CSV has all of them
+
+static inline void profile_ins(const ins_t* ins)
+{
+    profile.op_count [ins->op]++;
+    profile.op_cycles[ins->op] += ins->cycles;
+    profile.pc_count [ins->pc]++;
+    profile.pc_cycles[ins->pc] += ins->cycles;
+    profile.pc_op    [ins->pc]  = ins->op;
+}
+
+static void profile_vblank()
+{
+    if(profile.vblank_polls++ && cpu.cycles - profile.vblank_last < PROFILE_POLL_GAP)
+    {
+        profile.vblank_wait += cpu.cycles - profile.vblank_last;
+    }
+    
+    profile.vblank_last = cpu.cycles;
+}
+
+static const char* profile_name(u8 op)
+{
+    return op < sizeof(OP_NAMES) / sizeof(OP_NAMES[0]) ? OP_NAMES[op] : "???";
+}
+
+//qsort has no context argument, the report runs once at exit
+static const u64* profile_key;
+
+static int profile_compare(const void* a, const void* b)
+{
+    u64 x = profile_key[*(const u32*)a];
+    u64 y = profile_key[*(const u32*)b];
+    
+    return x < y ? 1 : x > y ? -1 : (int)(*(const u32*)a - *(const u32*)b);
+}
+
+//write the report, a sorted table to table and everything as CSV to csv_path
+static void profile_report(FILE* table, const char* csv_path)
+{
+    static u32 order[0x10000];
+    u64        count  = 0;
+    u64        cycles = 0;
+    
+    for(u32 i = 0; i < 256; i++) { count += profile.op_count[i]; cycles += profile.op_cycles[i]; }
+    
+    double percent = cycles ? 100.0 / cycles : 0;
+    
+    fprintf(table, "profile: %llu instructions, %llu cycles\n", count, cycles);
+    fprintf(table, "vblank:  %llu polls, %llu cycles waiting (%.1f%%)\n\n",
+                   profile.vblank_polls, profile.vblank_wait, profile.vblank_wait * percent);
+    
+    //opcodes by cycles
+    for(u32 i = 0; i < 256; i++) { order[i] = i; }
+    profile_key = profile.op_cycles;
+    qsort(order, 256, sizeof(u32), profile_compare);
+    
+    fprintf(table, "op    name %14s %14s %7s\n", "count", "cycles", "%");
+    for(u32 i = 0; i < 256 && profile.op_count[order[i]]; i++)
+    {
+        u32 op = order[i];
+        fprintf(table, "0x%02x  %-4s %14llu %14llu %6.2f%%\n",
+                       op, profile_name(op), profile.op_count[op], profile.op_cycles[op], profile.op_cycles[op] * percent);
+    }
+    
+    //hottest addresses
+    for(u32 i = 0; i < 0x10000; i++) { order[i] = i; }
+    profile_key = profile.pc_cycles;
+    qsort(order, 0x10000, sizeof(u32), profile_compare);
+    
+    fprintf(table, "\npc      op   %14s %14s %7s\n", "count", "cycles", "%");
+    for(u32 i = 0; i < PROFILE_TOP && profile.pc_count[order[i]]; i++)
+    {
+        u32 pc = order[i];
+        fprintf(table, "0x%04x  %-4s %14llu %14llu %6.2f%%\n",
+                       pc, profile_name(profile.pc_op[pc]), profile.pc_count[pc], profile.pc_cycles[pc], profile.pc_cycles[pc] * percent);
+    }
+    
+    FILE* csv = fopen(csv_path, "w");
+    if(csv == NULL) { fprintf(table, "error writing file: %s\n", csv_path); return; }
+    
+    fprintf(csv, "kind,id,name,count,cycles\n");
+    for(u32 op = 0; op < 256; op++)
+    {
+        if(profile.op_count[op]) { fprintf(csv, "op,%u,%s,%llu,%llu\n", op, profile_name(op), profile.op_count[op], profile.op_cycles[op]); }
+    }
+    for(u32 pc = 0; pc < 0x10000; pc++)
+    {
+        if(profile.pc_count[pc]) { fprintf(csv, "pc,%u,%s,%llu,%llu\n", pc, profile_name(profile.pc_op[pc]), profile.pc_count[pc], profile.pc_cycles[pc]); }
+    }
+    fprintf(csv, "vblank,0,,%llu,%llu\n", profile.vblank_polls, profile.vblank_wait);
+    
+    fclose(csv);
+}
+
+#endif
+
+/*****************/
+//CPU + RAM ACCESS
+/*****************/
+
+
+#define CPU_LAZY_FLAGS ((1 << CPU_ZERO) | (1 << CPU_OVERFLOW) | (1 << CPU_UNDERFLOW))
+
+//evaluate the lazy flags
+static inline u8 cpu_get_flags()
+{
+    return (cpu.flags & ~CPU_LAZY_FLAGS)          |
+           (cpu.zero      == 0)   << CPU_ZERO     |
+           (cpu.overflow  > 0xFF) << CPU_OVERFLOW |
+           (cpu.underflow > 0xFF) << CPU_UNDERFLOW;
+}
+
+//set all flags, the lazy ones get results that evaluate to them
+static inline void cpu_set_flags(u8 flags)
+{
+    cpu.flags     = flags & ~CPU_LAZY_FLAGS;
+    cpu.zero      = GET_BIT(flags, CPU_ZERO)      ? 0      : 1;
+    cpu.overflow  = GET_BIT(flags, CPU_OVERFLOW)  ? 0x100  : 0;
+    cpu.underflow = GET_BIT(flags, CPU_UNDERFLOW) ? 0xFFFF : 0;
+}
+
+
+//drop every block covering address
+static void block_invalidate(u16 address)
+{
+    for(u32 i = 0; i < BLOCK_MAX_BYTES; i++)
+    {
+        u16 start = address - i;
+        u16 index = block_cache.map[start];
+        
+        if(index && (u16)(address - start) < (u16)(block_cache.blocks[index - 1].end - start))
+        {
+            block_cache.map[start] = 0;
+            
+            //the running block may be the one that changed
+            cpu_deadline = 0;
+        }
+    }
+}
+
+//drop every block decoded from the ROM window, it shows another cartridge page now
+static void block_drop_rom()
+{
+    for(u32 i = 0; i < block_cache.count; i++)
+    {
+        block_t* block = &block_cache.blocks[i];
+        
+        if((block->start >= ROM_START || (u16)(block->end - 1) >= ROM_START) && block_cache.map[block->start] == i + 1)
+        {
+            block_cache.map[block->start] = 0;
+        }
+    }
+    
+    cpu_deadline = 0;
+}
+
+//is page p watched by the renderer
+static u8 gpu_watches_page(u32 p)
+{
+    u16 page_start = p * PAGE_SIZE;
+    
+    return p == (u32)(gpu.sdata >> 8)                                                                  ||
+           (u16)(page_start - gpu.bkgtex_p) < 256 * 16 || (u16)(gpu.bkgtex_p - page_start) < PAGE_SIZE ||
+           (u16)(page_start - gpu.sprtex_p) < 256 * 16 || (u16)(gpu.sprtex_p - page_start) < PAGE_SIZE;
+}
+
+//rebuild writable RAM pages
+//pages the renderer reads are written through mem_io so it can catch up first
+static void mem_map_ram()
+{
+    for(u32 p = RAM_START / PAGE_SIZE; p < RAM_SIZE / PAGE_SIZE; p++)
+    {
+        write_pages[p] = gpu_watches_page(p) || block_cache.code_pages[p] ? NULL : RAM + p * PAGE_SIZE;
+    }
+    
+    debug_map();
+}
+
+//map ROM pages straight into the selected cartridge page, switching pages only swaps these pointers
+static void mem_map_rom()
+{
+    for(u32 p = ROM_START / PAGE_SIZE + 1; p < PAGE_COUNT - 1; p++)
+    {
+        read_pages[p] = cart_buffer ? cart_buffer + ROM_PAGE_SIZE * cart_page + p * PAGE_SIZE - ROM_START : open_bus;
+    }
+    
+    debug_map();
+}
+
+//build page table
+static void mem_map_init()
+{
+    for(u32 p = 0; p < PAGE_COUNT; p++)
+    {
+        read_pages[p]  = open_bus;
+        write_pages[p] = NULL;
+    }
+    
+    //RAM
+    for(u32 p = RAM_START / PAGE_SIZE; p < RAM_SIZE / PAGE_SIZE; p++) { read_pages[p] = RAM + p * PAGE_SIZE; }
+    
+    //background maps and palettes, first and last page are only partially mapped
+    for(u32 p = BKG_PAL_MAP / PAGE_SIZE + 1; p < SCROLL_X / PAGE_SIZE; p++) { read_pages[p] = RAM + p * PAGE_SIZE; }
+    read_pages[BKG_PAL_MAP / PAGE_SIZE] = NULL;
+    read_pages[SCROLL_X    / PAGE_SIZE] = NULL;
+    
+    //I/O page
+    read_pages[STACK_START / PAGE_SIZE] = NULL;
+    
+    //ROM, first and last page are only partially mapped
+    read_pages[ROM_START / PAGE_SIZE] = NULL;
+    read_pages[PAGE_COUNT - 1]        = NULL;
+    mem_map_rom();
+    
+    mem_map_ram();
+}
+
+//map another cartridge page into the ROM window, page numbers wrap around the image
+static void cart_select(u8 page)
+{
+    if(cart_page_max == 0 || page % cart_page_max == cart_page) { return; }
+    
+    //the renderer may read textures from the ROM window
+    gpu_sync();
+    
+    cart_page = page % cart_page_max;
+    mem_map_rom();
+    block_drop_rom();
+    
+    if((u32)bkg_tiles.base + 256 * 16 > ROM_START) { memset(bkg_tiles.valid, 0, sizeof(bkg_tiles.valid)); }
+    if((u32)spr_tiles.base + 256 * 16 > ROM_START) { memset(spr_tiles.valid, 0, sizeof(spr_tiles.valid)); }
+}
+
+//ram access through I/O registers and partially mapped pages
+u8 mem_io(u8 mode, u16 address, u8 value)
+{
+    //watched page, see DEBUGGER
+    if(debug.watch_pages[address >> 8]) { debug_watch(mode, address, value); }
+    
+    //ram + palettes + map access
+    if((address >= RAM_START   && address < RAM_SIZE)    ||
+       (address >= BKG_PAL_MAP && address < BKG_TEX_MAP) ||
+       (address >= BKG_TEX_MAP && address < SCROLL_X)    ||
+       (address >= SCROLL_X    && address <= SCROLL_Y))
+    {
+        if(mode)
+        {
+            if(gpu_reads(address))                                           { gpu_touch(address);        }
+            if(block_cache.code_pages[address >> 8] && RAM[address] != value) { block_invalidate(address); }
+            RAM[address] = value; return 0;
+        }
+        else { return RAM[address]; };
+    }
+    //gpu control
+    else if(address == GPU_CTRL)
+    {
+        if(mode)
+        {
+            gpu_sync();
+            gpu.ctrl  = value;
+            //if(gpu.ctrl & 1) { gpu.sram = 0x2000; gpu.bram = 0x1000; }
+            //else             { gpu.sram = 0x1000; gpu.bram = 0x2000; }
+            switch(gpu.ctrl & 7)
+            {
+                case 0: { gpu.default_background_color = 13; break; } //black
+                case 1: { gpu.default_background_color = 46; break; } //white
+                case 2: { gpu.default_background_color = 21; break; } //red
+                case 3: { gpu.default_background_color = 41; break; } //green
+                case 4: { gpu.default_background_color = 33; break; } //blue
+                case 5: { gpu.default_background_color = 47; break; } //light blue
+                case 6: { gpu.default_background_color = 53; break; } //yellow
+                case 7: { gpu.default_background_color = 34; break; } //magenta
+            }
+            gpu.sdata = (gpu.ctrl << 3) & 0x0700;
+            mem_map_ram();
+            return 0;
+        } else { return gpu.ctrl; }
+    }
+    //gpu vblank
+    else if(address == GPU_VBLANK)
+    {
+        //writes turn to reads
+        gpu_catch_up();
+#ifdef PROFILE
+        profile_vblank();
+#endif
+        return gpu.vblank;
+    }
+    //controllers
+    else if(address >= CONTROLLER0 && address <= CONTROLLER1 + 1)
+    {
+        //writes turn to reads
+        return RAM[address];
+    }
+    else if (address >= ROM_START && address <= 0xFFFF)
+    {
+        //writes turn to reads
+        return cart_read(address);
+    }
+    //palette start index
+    else if(address == PALETTE_ST)
     {
         //reads turn to writes
         gpu.palette_index  =  gpu.write_reg_high ? (gpu.palette_index & 0x00FF) | (value << 8) : (gpu.palette_index & 0xFF00) | (value & 0x00FF);
@@ -360,15 +1116,24 @@ u8 mem_access(u8 mode, u16 address, u8 value)
     else if(address == SPRTEX_P)
     {
         //reads turn to writes
+        gpu_sync();
         gpu.sprtex_p       =  gpu.write_reg_high ? (gpu.sprtex_p & 0x00FF) | (value << 8) : (gpu.sprtex_p & 0xFF00) | (value & 0x00FF);
         gpu.write_reg_high = !gpu.write_reg_high;
+        mem_map_ram();
     }
     //texture data 1
     else if(address == BKGTEX_P)
     {
         //reads turn to writes
+        gpu_sync();
         gpu.bkgtex_p       =  gpu.write_reg_high ? (gpu.bkgtex_p & 0x00FF) | (value << 8) : (gpu.bkgtex_p & 0xFF00) | (value & 0x00FF);
         gpu.write_reg_high = !gpu.write_reg_high;
+        mem_map_ram();
+    }
+    //cartridge page select
+    else if(address == CART_BANK)
+    {
+        if(mode) { cart_select(value); return 0; } else { return cart_page; }
     }
     
     return 0;
@@ -467,172 +1232,2336 @@ u8 mem_access(u8 mode, u16 address, u8 value)
 void   push(u8 value) { WB(STACK_START | cpu.SP--, value); }
 u8     pop()          { return RB(STACK_START | ++cpu.SP); }
 
-//execute one intruction
-void cpu_exec()
+//cycles per opcode, undefined opcodes behave like NOP
+static u8 cpu_cycles[256];
+
+static void cpu_init()
+{
+    for(u32 i = 0; i < 256; i++)
+    {
+        cpu_cycles[i] = i < sizeof(OP_CYCLES) ? OP_CYCLES[i] : OP_CYCLES[OP_NOP];
+    }
+}
+
+//drop every decoded block
+static void block_flush()
+{
+    for(u32 i = 0; i < block_cache.count; i++) { block_cache.map[block_cache.blocks[i].start] = 0; }
+    block_cache.count = 0;
+}
+
+//code bytes, only the I/O page has read side effects, fetching elsewhere does not trip watchpoints
+static inline u8 block_fetch(u16 address)
+{
+    return address >> 8 == STACK_START >> 8 ? RB(address) : mem_peek(address);
+}
+
+//decode one instruction at address
+static void block_decode(ins_t* ins, u16 address)
 {
-    //fetch the operation code
-    u8 op_code = RB(cpu.PC++);
+    u8 op = block_fetch(address);
+    u8 length = 1 + (op < sizeof(OP_ARGS) ? OP_ARGS[op] : 0);
     
-#ifdef STEP
-    printf("executing [0x%02x: %s]\npre: (A: %u) (X: %u) (Y: %u) (PC: %u) (SP: %u) "
-           "(flags: %u%u%u%u%u%u%u%u)\n", op_code, OP_NAMES[op_code], cpu.A, cpu.X, cpu.Y, cpu.PC, cpu.SP, !!GET_BIT(cpu.flags, CPU_TERMINATE), 0, 0, 0, 0, !!GET_BIT(cpu.flags, CPU_UNDERFLOW), !!GET_BIT(cpu.flags, CPU_OVERFLOW), !!GET_BIT(cpu.flags, CPU_ZERO));
-#endif
+    ins->op     = op;
+    ins->cycles = cpu_cycles[op];
+    ins->pc     = address;
+    ins->next   = address + length;
+    
+    if(length == 2)      { ins->arg = block_fetch(address + 1); }
+    else if(length == 3) { u16 high = block_fetch(address + 1); ins->arg = (high << 8) | block_fetch(address + 2); }
+    else                 { ins->arg = 0; }
+}
+
+//stop before the instruction at pc, breakpoints are only looked at while decoding
+static void block_break(block_t* block, u16 pc)
+{
+    ins_t* ins = &block->ins[block->length++];
     
-#define CHECK_OVERFLOW(x, y)  if((x) > 0xff - (y)) { SET_BIT(cpu.flags, CPU_OVERFLOW);  } else { RESET_BIT(cpu.flags, CPU_OVERFLOW);  }
-#define CHECK_UNDERFLOW(x, y) if((x) < (y))        { SET_BIT(cpu.flags, CPU_UNDERFLOW); } else { RESET_BIT(cpu.flags, CPU_UNDERFLOW); }
-#define CHECK_ZERO(x)         if((x) == 0)         { SET_BIT(cpu.flags, CPU_ZERO);      } else { RESET_BIT(cpu.flags, CPU_ZERO);      }
+    ins->op     = OP_DEBUG;
+    ins->cycles = 0;
+    ins->arg    = 0;
+    ins->pc     = pc;
+    ins->next   = pc;
+}
+
+//does the instruction leave the straight line
+static inline u8 block_ends(u8 op)
+{
+    return op == OP_BIE || op == OP_BNE || op == OP_BIN || op == OP_BIP ||
+           op == OP_JMP || op == OP_CAL || op == OP_RET;
+}
+
+//can the instruction at address read from the I/O page
+static inline u8 block_in_io(u16 address)
+{
+    return address >> 8 == STACK_START >> 8 || (u16)(address + 2) >> 8 == STACK_START >> 8;
+}
+
+//decode the block starting at address
+static block_t* block_build(u16 address)
+{
+    //reads from the I/O page have side effects, decode them on every execution
+    if(block_in_io(address))
+    {
+        block_t* block = &block_cache.scratch;
+        
+        block->length = 0;
+        if(debug.breakpoints[address]) { block_break(block, address); }
+        
+        ins_t* ins = &block->ins[block->length++];
+        
+        block_decode(ins, address);
+        block->start  = address;
+        block->end    = ins->next;
+        block->cycles = ins->cycles;
+        
+        return block;
+    }
+    
+    if(block_cache.count == BLOCK_COUNT) { block_flush(); }
     
-    //execute op code
-    switch(op_code)
+    block_t* block = &block_cache.blocks[block_cache.count];
+    u16      pc    = address;
+    
+    block->start  = address;
+    block->length = 0;
+    block->cycles = 0;
+#ifdef CPU_JIT
+    block->code   = NULL;
+    block->no_jit = 0;
+    block->runs   = 0;
+#endif
+    
+    do
     {
-        case OP_NOP:   { break; }
-            
-        case OP_ADX:   { CHECK_OVERFLOW(cpu.A, cpu.X); cpu.A += cpu.X; CHECK_ZERO(cpu.A); break; }
-        case OP_ADY:   { CHECK_OVERFLOW(cpu.A, cpu.Y); cpu.A += cpu.Y; CHECK_ZERO(cpu.A); break; }
-            
-        case OP_SUX:   { CHECK_UNDERFLOW(cpu.A, cpu.X) cpu.A -= cpu.X; CHECK_ZERO(cpu.A); break; }
-        case OP_SUY:   { CHECK_UNDERFLOW(cpu.A, cpu.Y) cpu.A -= cpu.Y; CHECK_ZERO(cpu.A); break; }
+        if(block->length != 0 && block_in_io(pc)) { break; }
         
-        case OPIV_LDA: { cpu.A = RB(cpu.PC++); CHECK_ZERO(cpu.A); break; }
-        case OPIA_LDA:
-        {
-            cpu.A = RB((RB(cpu.PC++) << 8) | RB(cpu.PC++));
-            CHECK_ZERO(cpu.A); break;
-        }
-        case OPRAX_LDA:
-        {
-            cpu.A = RB(((RB(cpu.PC++) << 8) | RB(cpu.PC++)) + cpu.X);
-            CHECK_ZERO(cpu.A); break;
-        }
-            
-        case OPRAY_LDA:
-        {
-            cpu.A = RB(((RB(cpu.PC++) << 8) | RB(cpu.PC++)) + cpu.Y);
-            CHECK_ZERO(cpu.A); break;
-        }
-            
-        case OPIA_STA:
-        {
-            WB((RB(cpu.PC++) << 8) | RB(cpu.PC++), cpu.A);
-            break;
-        }
-            
-        case OPIV_ADD: { u8 arg = RB(cpu.PC++); CHECK_OVERFLOW(cpu.A, arg);  cpu.A += arg; CHECK_ZERO(cpu.A); break; }
-        case OPIV_SUB: { u8 arg = RB(cpu.PC++); CHECK_UNDERFLOW(cpu.A, arg); cpu.A -= arg; CHECK_ZERO(cpu.A); break; }
-            
-        case OP_INA: { CHECK_OVERFLOW(cpu.A, 1); cpu.A++; CHECK_ZERO(cpu.A); break; }
-        case OP_INX: { CHECK_OVERFLOW(cpu.X, 1); cpu.X++; CHECK_ZERO(cpu.X); break; }
-        case OP_INY: { CHECK_OVERFLOW(cpu.Y, 1); cpu.Y++; CHECK_ZERO(cpu.Y); break; }
-            
-        case OP_DEA: { CHECK_UNDERFLOW(cpu.A, 1); cpu.A--; CHECK_ZERO(cpu.A); break; }
-        case OP_DEX: { CHECK_UNDERFLOW(cpu.X, 1); cpu.X--; CHECK_ZERO(cpu.X); break; }
-        case OP_DEY: { CHECK_UNDERFLOW(cpu.Y, 1); cpu.Y--; CHECK_ZERO(cpu.Y); break; }
-          
-        case OP_PUA: { push(cpu.A);                      break; }
-        case OP_PPA: { cpu.A = pop(); CHECK_ZERO(cpu.A); break; }
-            
-        case OP_CMP: { u8 arg = RB(cpu.PC++); CHECK_UNDERFLOW(cpu.A, arg); CHECK_ZERO(cpu.A - arg); break; }
-            
-        case OP_BIE: { if(GET_BIT(cpu.flags,       CPU_ZERO)) { cpu.PC = (RB(cpu.PC++) << 8) | RB(cpu.PC++); } else { cpu.PC += 2; } break; }
-        case OP_BNE: { if(!GET_BIT(cpu.flags,      CPU_ZERO)) { cpu.PC = (RB(cpu.PC++) << 8) | RB(cpu.PC++); } else { cpu.PC += 2; } break; }
-        case OP_BIN: { if(GET_BIT(cpu.flags,  CPU_UNDERFLOW)) { cpu.PC = (RB(cpu.PC++) << 8) | RB(cpu.PC++); } else { cpu.PC += 2; } break; }
-        case OP_BIP: { if(!GET_BIT(cpu.flags, CPU_UNDERFLOW)) { cpu.PC = (RB(cpu.PC++) << 8) | RB(cpu.PC++); } else { cpu.PC += 2; } break; }
-        case OP_JMP: { cpu.PC = (RB(cpu.PC++) << 8) | RB(cpu.PC++); break; }
-            
-        case OP_CAL:
+        //breakpoints start a block
+        if(debug.breakpoints[pc])
         {
-            u16 address = (RB(cpu.PC++) << 8) | RB(cpu.PC++);
-            push(cpu.PC >> 8);
-            push(cpu.PC);
-            cpu.PC      = address;
-            break;
+            if(block->length != 0) { break; }
+            block_break(block, pc);
         }
-        case OP_RET: { cpu.PC = (pop() << 8) | (pop()); break; }
-            
-        case OP_XOR: { cpu.A ^= RB(cpu.PC++); CHECK_ZERO(cpu.A); break; }
-            
-        case OP_INT:
+        
+        ins_t* ins = &block->ins[block->length++];
+        
+        block_decode(ins, pc);
+        block->cycles += ins->cycles;
+        
+        //watch writes into the decoded bytes
+        for(u16 a = pc; a != ins->next; a++)
         {
-            u8 arg = RB(cpu.PC++);
-            
-            switch(arg)
+            if(!block_cache.code_pages[a >> 8])
             {
-                case 0x01: { SET_BIT(cpu.flags, CPU_TERMINATE); break; }
-                case 0x10: { fputc(cpu.A, stdout);              break; } //TODO: replace with my gpu implementation
-                default: { break; }
+                block_cache.code_pages[a >> 8] = 1;
+                write_pages[a >> 8]            = NULL;
             }
-            
-            break;
         }
-            
-        case OPIV_LDX: { cpu.X = RB(cpu.PC++); CHECK_ZERO(cpu.X); break; }
-            
-        case OPIV_LDY: { cpu.Y = RB(cpu.PC++); CHECK_ZERO(cpu.Y); break; }
-            
-        case OP_TXA: { cpu.A = cpu.X; CHECK_ZERO(cpu.A); break; }
-        case OP_TYA: { cpu.A = cpu.Y; CHECK_ZERO(cpu.A); break; }
-        case OP_TAX: { cpu.X = cpu.A; CHECK_ZERO(cpu.X); break; }
-        case OP_TYX: { cpu.X = cpu.Y; CHECK_ZERO(cpu.X); break; }
-        case OP_TAY: { cpu.Y = cpu.A; CHECK_ZERO(cpu.Y); break; }
-        case OP_TXY: { cpu.Y = cpu.X; CHECK_ZERO(cpu.Y); break; }
-            
-        case OP_AND: { cpu.A &= RB(cpu.PC++);  CHECK_ZERO(cpu.A); break; }
-        case OP_INV: { cpu.A = ~cpu.A;         CHECK_ZERO(cpu.A); break; }
-        case OP_SAL: { cpu.A <<= RB(cpu.PC++); CHECK_ZERO(cpu.A); break; }
-        case OP_SAR: { cpu.A >>= RB(cpu.PC++); CHECK_ZERO(cpu.A); break; }
-        case OP_AOR: { cpu.A |= RB(cpu.PC++);  CHECK_ZERO(cpu.A); break; }
-            
-        case OP_ROR: { cpu.A = (cpu.A << 7) | (cpu.A >> 1); CHECK_ZERO(cpu.A); break; }
-        case OP_ROL: { cpu.A = (cpu.A >> 7) | (cpu.A << 1); CHECK_ZERO(cpu.A); break; }
-            
-        case OP_CMX: { u8 arg = RB(cpu.PC++); CHECK_UNDERFLOW(cpu.X, arg); CHECK_ZERO(cpu.X - arg); break; }
-        case OP_CMY: { u8 arg = RB(cpu.PC++); CHECK_UNDERFLOW(cpu.Y, arg); CHECK_ZERO(cpu.Y - arg); break; }
-            
-        default: { break; }
+        
+        pc = ins->next;
     }
+    while(block->length < BLOCK_MAX_INS && !block_ends(block->ins[block->length - 1].op));
     
-    //emulate op cycles
-    //1 cpu cycles = 3 gpu cycles
-    for(u8 i = 0; i < OP_CYCLES[op_code]; i++)
-    {
-        gpu_exec(); gpu_exec(); gpu_exec();
-    }
+    block->end = pc;
+    block_cache.map[address] = ++block_cache.count;
     
-#ifdef STEP
-    printf("post: (A: %u) (X: %u) (Y: %u) (PC: %u) (SP: %u) "
-           "(flags: %u%u%u%u%u%u%u%u)\n", cpu.A, cpu.X, cpu.Y, cpu.PC, cpu.SP, !!GET_BIT(cpu.flags, CPU_TERMINATE), 0, 0, 0, 0, !!GET_BIT(cpu.flags, CPU_UNDERFLOW), !!GET_BIT(cpu.flags, CPU_OVERFLOW), !!GET_BIT(cpu.flags, CPU_ZERO));
+    return block;
+}
+
+//find or decode the block starting at address
+static inline block_t* block_get(u16 address)
+{
+    u16 index = block_cache.map[address];
+    
+    return index ? &block_cache.blocks[index - 1] : block_build(address);
+}
+
+/*****************/
+//TRACE
+/*****************/
+
+//while recording, the interpreter writes every instruction into a ring of fixed size records
+//and the JIT leaves the blocks to it, -DSTEP builds record from the first instruction
+//the ring lives in a shared mapping of the trace file, so the last records survive a crash,
+//hosts without mmap keep it in memory and write it when the machine quits
+//F8 starts and stops recording, com -t prints the file
+
+#define TRACE_RECORDS (1 << 20) //default ring size, 24 MiB
+
+static const char* trace_path    = "trace.bin";
+static u32         trace_records = TRACE_RECORDS;
+
+//create the ring with trace_records rounded up to a power of two, returns 0 on failure
+static u8 trace_open()
+{
+    u32 capacity = 1;
+    while(capacity < trace_records && capacity < (1u << 31)) { capacity <<= 1; }
+    
+    u64 length = sizeof(trace_header_t) + (u64)capacity * sizeof(trace_record_t);
+    
+#ifdef FILE_MMAP
+    int fd = open(trace_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    
+    if(fd < 0) { return 0; }
+    if(ftruncate(fd, length) != 0) { close(fd); return 0; }
+    
+    void* base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    
+    if(base == MAP_FAILED) { return 0; }
+#else
+    void* base = calloc(1, length);
+    
+    if(base == NULL) { return 0; }
+#endif
+    
+    trace.header  = base;
+    trace.records = (trace_record_t*)(trace.header + 1);
+    trace.length  = length;
+    trace.mask    = capacity - 1;
+    
+    memcpy(trace.header->magic, "CMT", 3);
+    trace.header->version  = TRACE_VERSION;
+    trace.header->capacity = capacity;
+    trace.header->count    = 0;
+    
+    return 1;
+}
+
+static void trace_close()
+{
+    if(trace.header == NULL) { return; }
+    
+#ifdef FILE_MMAP
+    munmap(trace.header, trace.length);
+#else
+    FILE* out = fopen(trace_path, "wb");
+    
+    if(out == NULL || fwrite(trace.header, trace.length, 1, out) != 1) { printf("error writing file: %s\n", trace_path); }
+    if(out) { fclose(out); }
+    free(trace.header);
+#endif
+    
+    trace.header = NULL;
+    trace.on     = 0;
+}
+
+//start or stop recording, the ring is created on first use
+void trace_toggle()
+{
+    if(trace.header == NULL && !trace_open()) { printf("error writing file: %s\n", trace_path); return; }
+    
+    trace.on = !trace.on;
+    printf("trace: %s (%llu records)\n", trace.on ? "on" : "off", trace.header->count);
+}
+
+static inline void trace_ins(const ins_t* ins)
+{
+    trace_record_t* record = &trace.records[trace.header->count++ & trace.mask];
+    
+    record->cycles = cpu.cycles;
+    record->pc     = ins->pc;
+    record->arg    = ins->arg;
+    record->op     = ins->op;
+    record->A      = cpu.A;
+    record->X      = cpu.X;
+    record->Y      = cpu.Y;
+    record->SP     = cpu.SP;
+    record->flags  = cpu_get_flags();
+}
+
+/*****************/
+//DEBUGGER
+/*****************/
+
+//breakpoints are decoded into their blocks as a pseudo instruction (OP_DEBUG) in front of the stopping address,
+//watched pages leave the page table so their accesses reach mem_io, nothing is checked per instruction otherwise
+//the console runs between cpu_run calls, -debug opens it before the first instruction, F9 at the next frame
+//native blocks stop after the instruction that touched a watched address, blocks with breakpoints stay interpreted
+
+//named ranges the console accepts in place of addresses
+#define DEBUG_NAME(name, size) { #name, name, name + size - 1 }
+
+static const struct { const char* name; u16 start, end; } debug_names[] =
+{
+    DEBUG_NAME(RAM_START,   RAM_SIZE),
+    DEBUG_NAME(STACK_START, PAGE_SIZE),
+    DEBUG_NAME(GPU_CTRL,    1),
+    DEBUG_NAME(GPU_VBLANK,  1),
+    DEBUG_NAME(CONTROLLER0, 2),
+    DEBUG_NAME(CONTROLLER1, 2),
+    DEBUG_NAME(PALETTE_ST,  1),
+    DEBUG_NAME(PALETTE_DT,  1),
+    DEBUG_NAME(SPRTEX_P,    2),
+    DEBUG_NAME(BKGTEX_P,    2),
+    DEBUG_NAME(CART_BANK,   1),
+    DEBUG_NAME(BKG_PAL_MAP, 0x0168),
+    DEBUG_NAME(BKG_TEX_MAP, 0x03C0),
+    DEBUG_NAME(BKG_PALETTE, 0x0020),
+    DEBUG_NAME(SPR_PALETTE, 0x0020),
+    DEBUG_NAME(SCROLL_X,    1),
+    DEBUG_NAME(SCROLL_Y,    1),
+    DEBUG_NAME(ROM_START,   ROM_PAGE_SIZE),
+};
+
+//stop the core after the current instruction and open the console
+static void debug_stop(u8 reason)
+{
+    debug.stop   = reason;
+    cpu_deadline = 0;
+}
+
+//take watched pages out of the page table, the page table builders call it last
+void debug_map()
+{
+    if(debug.watch_count == 0) { return; }
+    
+    for(u32 p = 0; p < PAGE_COUNT; p++)
+    {
+        if(debug.watch_pages[p] & WATCH_READ)  { read_pages[p]  = NULL; }
+        if(debug.watch_pages[p] & WATCH_WRITE) { write_pages[p] = NULL; }
+    }
+}
+
+//rebuild the watched pages after adding or removing a watchpoint
+static void debug_map_watches()
+{
+    memset(debug.watch_pages, 0, sizeof(debug.watch_pages));
+    
+    for(u32 i = 0; i < debug.watch_count; i++)
+    {
+        for(u32 p = debug.watches[i].start >> 8; p <= (u32)(debug.watches[i].end >> 8); p++) { debug.watch_pages[p] |= debug.watches[i].mode; }
+    }
+    
+    //removed watches give their pages back
+    mem_map_init();
+}
+
+//access to a watched page, mem_io calls it before the access happens
+void debug_watch(u8 mode, u16 address, u8 value)
+{
+    u8 access = mode ? WATCH_WRITE : WATCH_READ;
+    
+    for(u32 i = 0; i < debug.watch_count; i++)
+    {
+        watch_t* watch = &debug.watches[i];
+        
+        if((watch->mode & access) && address >= watch->start && address <= watch->end)
+        {
+            if(mode) { printf("watch %u: write $%04x = $%02x\n", i, address, value); } else { printf("watch %u: read $%04x\n", i, address); }
+            
+            debug_stop(DEBUG_WATCH);
+            return;
+        }
+    }
+}
+
+static void debug_set_break(u16 address, u8 on)
+{
+    debug.breakpoints[address] = on;
+    
+    //blocks covering the address are decoded again with or without the stop
+    block_invalidate(address);
+}
+
+//parse an address or a named range, numbers are decimal, 0x or $ hex
+static u8 debug_address(const char* text, u16* start, u16* end)
+{
+    if(strequ(text, "SPRITES"))
+    {
+        *start = gpu.sdata;
+        *end   = gpu.sdata + NUM_SPRITES * sizeof(sprite_t) - 1;
+        return 1;
+    }
+    
+    for(u32 i = 0; i < sizeof(debug_names) / sizeof(debug_names[0]); i++)
+    {
+        if(strequ(text, debug_names[i].name)) { *start = debug_names[i].start; *end = debug_names[i].end; return 1; }
+    }
+    
+    const char* digits = text[0] == '$' ? text + 1 : text;
+    char*       rest   = NULL;
+    u64         value  = strtoull(digits, &rest, text[0] == '$' ? 16 : 0);
+    
+    if(rest == digits || *rest != '\0' || value > 0xFFFF) { return 0; }
+    
+    *start = *end = value;
+    
+    return 1;
+}
+
+//parse "address", "start-end" or a name, returns 0 if it is none of them
+static u8 debug_range(char* text, u16* start, u16* end)
+{
+    for(char* c = text; *c; c++) { *c = toupper((u8)*c); }
+    
+    u16   unused;
+    char* dash = strchr(text, '-');
+    
+    if(dash == NULL) { return debug_address(text, start, end); }
+    
+    *dash = '\0';
+    
+    return debug_address(text, start, &unused) && debug_address(dash + 1, &unused, end) && *start <= *end;
+}
+
+//print the instruction at address, returns the address of the following one
+static u16 debug_disassemble(u16 address)
+{
+    u8 op    = mem_peek(address);
+    u8 known = op < sizeof(OP_NAMES) / sizeof(OP_NAMES[0]);
+    u8 size  = 1 + (known ? OP_ARGS[op] : 0);
+    u16 arg  = size == 3 ? mem_peek(address + 1) << 8 | mem_peek(address + 2) : mem_peek(address + 1);
+    
+    char args[16] = "";
+    
+    if(known && OP_MODES[op] == OP_MODE_VAL)     { snprintf(args, sizeof(args), "#$%02x", (u8)arg); }
+    if(known && OP_MODES[op] == OP_MODE_ADD)     { snprintf(args, sizeof(args), "$%04x", arg); }
+    if(known && OP_MODES[op] == OP_MODE_REL_ADD) { snprintf(args, sizeof(args), "$%04x,%c", arg, op == OPRAX_LDA ? 'x' : 'y'); }
+    
+    printf("%c %04x  %s %s\n", debug.breakpoints[address] ? '*' : ' ', address, known ? OP_NAMES[op] : "???", args);
+    
+    return address + size;
+}
+
+static void debug_registers()
+{
+    u8 flags = cpu_get_flags();
+    
+    printf("(A: %u) (X: %u) (Y: %u) (SP: %u) (PC: $%04x) (flags: %u%u%u%u%u%u%u%u) (cycles: %llu) (frame: %llu)\n",
+           cpu.A, cpu.X, cpu.Y, cpu.SP, cpu.PC,
+           !!GET_BIT(flags, 7), !!GET_BIT(flags, 6), !!GET_BIT(flags, 5), !!GET_BIT(flags, 4),
+           !!GET_BIT(flags, 3), !!GET_BIT(flags, 2), !!GET_BIT(flags, 1), !!GET_BIT(flags, 0), cpu.cycles, gpu.frames);
+    debug_disassemble(cpu.PC);
+}
+
+static void debug_list()
+{
+    for(u32 a = 0; a < 0x10000; a++)
+    {
+        if(debug.breakpoints[a]) { printf("break $%04x\n", a); }
+    }
+    
+    for(u32 i = 0; i < debug.watch_count; i++)
+    {
+        watch_t* watch = &debug.watches[i];
+        
+        printf("watch %u: $%04x-$%04x %s%s\n", i, watch->start, watch->end,
+               watch->mode & WATCH_READ ? "r" : "", watch->mode & WATCH_WRITE ? "w" : "");
+    }
+}
+
+static void debug_help()
+{
+    printf("r                  registers and the next instruction\n");
+    printf("m <range> [count]  dump memory, count defaults to the range or 64 bytes\n");
+    printf("u [address] [n]    disassemble n instructions, from the PC by default\n");
+    printf("b [address]        set a breakpoint, list breakpoints and watchpoints without address\n");
+    printf("w <range> [r|w|rw] watch reads and/or writes, writes by default\n");
+    printf("d [address|range]  delete the breakpoint or the watchpoints covering it, everything without argument\n");
+    printf("s [n]              step n instructions\n");
+    printf("c                  continue\n");
+    printf("t                  start or stop the trace\n");
+    printf("q                  quit\n");
+    printf("ranges are start-end, decimal, 0x or $ hex, a register name like SCROLL_X or SPRITES\n");
+}
+
+//interactive console, returns when the machine should run again
+//end of input continues without the console
+void debug_console(u8 reason)
+{
+    char line[256];
+    
+    debug.stop  = 0;
+    debug.steps = 0;
+    debug_registers();
+    
+    while(1)
+    {
+        printf("> ");
+        fflush(stdout);
+        
+        if(fgets(line, sizeof(line), stdin) == NULL) { printf("\n"); break; }
+        
+        char* command = strtok(line, " \t\r\n");
+        char* arg0    = strtok(NULL, " \t\r\n");
+        char* arg1    = strtok(NULL, " \t\r\n");
+        u16   start, end;
+        
+        if(command == NULL) { continue; }
+        
+        //s takes a count, everything else an address or range
+        if(arg0 && !strequ(command, "s") && !debug_range(arg0, &start, &end)) { printf("error: %s is not an address\n", arg0); continue; }
+        
+        if(strequ(command, "r"))
+        {
+            debug_registers();
+        }
+        else if(strequ(command, "m"))
+        {
+            if(arg0 == NULL) { printf("error: m expects an address\n"); continue; }
+            
+            u32 count = arg1 ? strtoul(arg1, NULL, 0) : start != end ? (u32)(end - start) + 1 : 64;
+            
+            for(u32 i = 0; i < count; i++)
+            {
+                if(i % 16 == 0) { printf("%s%04x:", i ? "\n" : "", (u16)(start + i)); }
+                printf(" %02x", mem_peek(start + i));
+            }
+            printf("\n");
+        }
+        else if(strequ(command, "u"))
+        {
+            u16 address = arg0 ? start : cpu.PC;
+            u32 count   = arg1 ? strtoul(arg1, NULL, 0) : 16;
+            
+            for(u32 i = 0; i < count; i++) { address = debug_disassemble(address); }
+        }
+        else if(strequ(command, "b"))
+        {
+            if(arg0) { debug_set_break(start, 1); } else { debug_list(); }
+        }
+        else if(strequ(command, "w"))
+        {
+            u8 mode = WATCH_WRITE;
+            
+            if(arg1 && strequ(arg1, "r"))       { mode = WATCH_READ; }
+            else if(arg1 && strequ(arg1, "rw")) { mode = WATCH_READ | WATCH_WRITE; }
+            else if(arg1 && !strequ(arg1, "w")) { printf("error: %s is not r, w or rw\n", arg1); continue; }
+            
+            if(arg0 == NULL)                       { printf("error: w expects a range\n"); continue; }
+            if(debug.watch_count == DEBUG_WATCHES) { printf("error: all %u watchpoints are in use\n", DEBUG_WATCHES); continue; }
+            
+            debug.watches[debug.watch_count++] = (watch_t){ start, end, mode };
+            debug_map_watches();
+        }
+        else if(strequ(command, "d"))
+        {
+            u32 kept = 0;
+            
+            for(u32 a = 0; a < 0x10000; a++)
+            {
+                if(debug.breakpoints[a] && (arg0 == NULL || (a >= start && a <= end))) { debug_set_break(a, 0); }
+            }
+            
+            for(u32 i = 0; i < debug.watch_count; i++)
+            {
+                watch_t watch = debug.watches[i];
+                
+                if(arg0 && (watch.end < start || watch.start > end)) { debug.watches[kept++] = watch; }
+            }
+            
+            debug.watch_count = kept;
+            debug_map_watches();
+        }
+        else if(strequ(command, "s"))
+        {
+            char* rest  = NULL;
+            u64   count = arg0 ? strtoull(arg0, &rest, 0) : 1;
+            
+            if(arg0 && (rest == arg0 || *rest != '\0')) { printf("error: %s is not a count\n", arg0); continue; }
+            if(count == 0) { continue; }
+            
+            debug.steps = count;
+            break;
+        }
+        else if(strequ(command, "c"))
+        {
+            break;
+        }
+        else if(strequ(command, "t"))
+        {
+            trace_toggle();
+        }
+        else if(strequ(command, "q"))
+        {
+            SET_BIT(cpu.flags, CPU_TERMINATE);
+            break;
+        }
+        else
+        {
+            debug_help();
+        }
+    }
+    
+    //the breakpoint the cpu stopped on must not stop it again,
+    //one it only arrived at by stepping or F9 has not stopped it yet
+    debug.skip = reason == DEBUG_BREAK && debug.breakpoints[cpu.PC];
+}
+
+/*****************/
+//X86-64 JIT
+/*****************/
+
+//blocks are translated to native code that keeps A, X, Y, SP and flags in host registers
+//memory goes through the page table, NULL pages call back into mem_io after the gpu caught up
+//a block only runs natively if it can neither reach the cycle limit nor finish a frame,
+//everything else (INT, code in the I/O page, blocks close to an event) stays on the interpreter
+//a finished block jumps straight into the next translated block while that one fits before the limit,
+//the guest registers stay in host registers until a block has to return to the interpreter
+#ifdef CPU_JIT
+
+#define JIT_SIZE      (4 << 20)
+#define JIT_MAX_BLOCK 0x2000 //upper bound of the native size of one block
+#define JIT_HOT       8      //blocks are translated after this many runs, rewritten code rarely gets there
+
+
+enum X64_REGS { RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+enum X64_COND { CC_C = 2, CC_Z = 4, CC_NZ = 5, CC_A = 7 };
+
+//guest registers, all callee saved
+#define J_A  RBX
+#define J_X  R12
+#define J_Y  R13
+#define J_SP R14
+#define J_F  R15
+#define J_PC RBP //PC when the block is left
+
+//helpers called from native code
+static void jit_charge(u32 cycles)
+{
+    u32 run = cycles - jit.charged;
+    
+    jit.charged = cycles;
+    cpu.cycles += run;
+}
+static u32  jit_read (u32 address, u32 cycles)            { jit_charge(cycles); return mem_io(READ, address, 0); }
+static void jit_write(u32 address, u32 value, u32 cycles) { jit_charge(cycles); mem_io(WRITE, address, value); }
+
+//instruction encoding
+static void x_byte (u8  v) { *jit.p++ = v; }
+static void x_dword(u32 v) { memcpy(jit.p, &v, 4); jit.p += 4; }
+static void x_qword(u64 v) { memcpy(jit.p, &v, 8); jit.p += 8; }
+
+static void x_rex(u8 w, u8 r, u8 x, u8 b)
+{
+    if(w || r >= 8 || x >= 8 || b >= 8) { x_byte(0x40 | w << 3 | (r >> 3) << 2 | (x >> 3) << 1 | b >> 3); }
+}
+static void x_modrm(u8 mod, u8 reg, u8 rm) { x_byte(mod << 6 | (reg & 7) << 3 | (rm & 7)); }
+static void x_sib  (u8 scale, u8 index, u8 base) { x_byte(scale << 6 | (index & 7) << 3 | (base & 7)); }
+
+static void x_push(u8 r) { if(r >= 8) { x_byte(0x41); } x_byte(0x50 + (r & 7)); }
+static void x_pop (u8 r) { if(r >= 8) { x_byte(0x41); } x_byte(0x58 + (r & 7)); }
+
+//op dst, src for the register forms of add 0x00, or 0x09, test 0x84, mov 0x88 / 0x89, ...
+static void x_rr    (u8 op, u8 dst, u8 src)       { x_rex(0, src, 0, dst); x_byte(op); x_modrm(3, src, dst); }
+//group 1 ops (add 0, or 1, and 4, sub 5, xor 6, cmp 7) with an immediate
+static void x_ri8   (u8 digit, u8 dst, u8 imm)    { x_rex(0, 0, 0, dst); x_byte(0x80); x_modrm(3, digit, dst); x_byte(imm);  }
+static void x_ri32  (u8 digit, u8 dst, u32 imm)   { x_rex(0, 0, 0, dst); x_byte(0x81); x_modrm(3, digit, dst); x_dword(imm); }
+//8-bit unary and shift groups (rol 0xD0 /0, ror 0xD0 /1, not 0xF6 /2, shl 0xC0 /4, shr 0xC0 /5)
+static void x_grp8  (u8 op, u8 digit, u8 dst)     { x_rex(0, 0, 0, dst); x_byte(op); x_modrm(3, digit, dst); }
+static void x_shift (u8 digit, u8 dst, u8 count)  { x_rex(0, 0, 0, dst); x_byte(0xC1); x_modrm(3, digit, dst); x_byte(count); }
+static void x_mov8i (u8 dst, u8 imm)              { x_rex(0, 0, 0, dst); x_byte(0xB0 + (dst & 7)); x_byte(imm);  }
+static void x_mov32i(u8 dst, u32 imm)             { x_rex(0, 0, 0, dst); x_byte(0xB8 + (dst & 7)); x_dword(imm); }
+static void x_mov64i(u8 dst, u64 imm)             { x_rex(1, 0, 0, dst); x_byte(0xB8 + (dst & 7)); x_qword(imm); }
+static void x_movzx8(u8 dst, u8 src)              { x_rex(0, dst, 0, src); x_byte(0x0F); x_byte(0xB6); x_modrm(3, dst, src); }
+static void x_movzx16(u8 dst, u8 src)             { x_rex(0, dst, 0, src); x_byte(0x0F); x_byte(0xB7); x_modrm(3, dst, src); }
+//64-bit op dst, src for the register forms, add 0x01
+static void x_rr64  (u8 op, u8 dst, u8 src)       { x_rex(1, src, 0, dst); x_byte(op); x_modrm(3, src, dst); }
+static void x_setcc (u8 cc, u8 dst)               { x_rex(0, 0, 0, dst); x_byte(0x0F); x_byte(0x90 + cc); x_modrm(3, 0, dst); }
+static void x_cmov  (u8 cc, u8 dst, u8 src)       { x_rex(0, dst, 0, src); x_byte(0x0F); x_byte(0x40 + cc); x_modrm(3, dst, src); }
+static void x_call  (u64 function)                { x_mov64i(RAX, function); x_byte(0xFF); x_modrm(3, 2, RAX); }
+
+//memory forms: [base + disp32] and [base + index * scale]
+static void x_load8  (u8 dst, u8 base, u32 disp) { x_rex(0, dst, 0, base); x_byte(0x0F); x_byte(0xB6); x_modrm(2, dst, base); x_dword(disp); }
+static void x_store8 (u8 base, u32 disp, u8 src)  { x_rex(0, src, 0, base); x_byte(0x88); x_modrm(2, src, base); x_dword(disp); }
+static void x_store16(u8 base, u32 disp, u8 src)  { x_byte(0x66); x_rex(0, src, 0, base); x_byte(0x89); x_modrm(2, src, base); x_dword(disp); }
+static void x_loadptr(u8 dst, u8 base, u8 index)  { x_rex(1, dst, index, base); x_byte(0x8B); x_modrm(0, dst, 4); x_sib(3, index, base); }
+static void x_loadidx(u8 dst, u8 base, u8 index)  { x_rex(0, dst, index, base); x_byte(0x0F); x_byte(0xB6); x_modrm(0, dst, 4); x_sib(0, index, base); }
+static void x_storeidx(u8 base, u8 index, u8 src) { x_rex(0, src, index, base); x_byte(0x88); x_modrm(0, src, 4); x_sib(0, index, base); }
+//op reg, [base] and op [base], reg with 64-bit operands (add 0x01 / 0x03, sub 0x2B, cmp 0x3B, mov 0x8B), base is not RSP or RBP
+static void x_mem64  (u8 op, u8 reg, u8 base)     { x_rex(1, reg, 0, base); x_byte(op); x_modrm(0, reg, base); }
+
+//forward jumps, patched once the target is known
+static u8*  x_jcc8 (u8 cc) { x_byte(0x70 + cc); x_byte(0); return jit.p - 1; }
+static u8*  x_jmp8 ()      { x_byte(0xEB);      x_byte(0); return jit.p - 1; }
+static u8*  x_jmp32()      { x_byte(0xE9);      x_dword(0); return jit.p - 4; }
+static void x_land8 (u8* at) { *at = (u8)(jit.p - (at + 1)); }
+static void x_land32(u8* at) { u32 rel = (u32)(jit.p - (at + 4)); memcpy(at, &rel, 4); }
+
+//guest flags from the host flags of the last 8-bit op, only the ones in live are written
+//zero always, the carry goes to the overflow or underflow flag
+static void j_flags(int carry, u8 live)
+{
+    u8 zero = GET_BIT(live, CPU_ZERO) != 0;
+    
+    if(carry >= 0 && !GET_BIT(live, carry)) { carry = -1; }
+    if(!zero && carry < 0)                  { return; }
+    
+    if(carry >= 0) { x_setcc(CC_C, RAX); }
+    if(zero)       { x_setcc(CC_Z, RCX); }
+    x_ri32(4, J_F, ~((zero ? 1u << CPU_ZERO : 0) | (carry >= 0 ? 1u << carry : 0)));
+    
+    if(zero)
+    {
+        x_movzx8(RCX, RCX);
+        x_rr(0x09, J_F, RCX);
+    }
+    
+    if(carry >= 0)
+    {
+        x_movzx8(RAX, RAX);
+        x_shift(4, RAX, carry);
+        x_rr(0x09, J_F, RAX);
+    }
+}
+
+//zero flag of a known value
+static void j_zero(u8 value, u8 live)
+{
+    if(!GET_BIT(live, CPU_ZERO)) { return; }
+    
+    if(value == 0) { x_ri32(1, J_F, 1u << CPU_ZERO);    }
+    else           { x_ri32(4, J_F, ~(1u << CPU_ZERO)); }
+}
+
+//read byte at EDI into EAX
+static void j_read(u32 cycles)
+{
+    x_rr(0x89, RAX, RDI);
+    x_shift(5, RAX, 8);
+    x_mov64i(RDX, (u64)read_pages);
+    x_loadptr(RCX, RDX, RAX);
+    x_rex(1, RCX, 0, RCX); x_byte(0x85); x_modrm(3, RCX, RCX);
+    u8* slow = x_jcc8(CC_Z);
+    
+    x_rr(0x89, RAX, RDI);
+    x_ri32(4, RAX, 0xFF);
+    x_loadidx(RAX, RCX, RAX);
+    u8* done = x_jmp8();
+    
+    x_land8(slow);
+    x_mov32i(RSI, cycles);
+    x_call((u64)jit_read);
+    x_land8(done);
+}
+
+//write byte ESI to EDI
+static void j_write(u32 cycles)
+{
+    x_rr(0x89, RAX, RDI);
+    x_shift(5, RAX, 8);
+    x_mov64i(RDX, (u64)write_pages);
+    x_loadptr(RCX, RDX, RAX);
+    x_rex(1, RCX, 0, RCX); x_byte(0x85); x_modrm(3, RCX, RCX);
+    u8* slow = x_jcc8(CC_Z);
+    
+    x_rr(0x89, RAX, RDI);
+    x_ri32(4, RAX, 0xFF);
+    x_rr(0x89, RDX, RSI);
+    x_storeidx(RCX, RAX, RDX);
+    u8* done = x_jmp8();
+    
+    x_land8(slow);
+    x_mov32i(RDX, cycles);
+    x_call((u64)jit_write);
+    x_land8(done);
+}
+
+//the stack lives in the I/O page, always through mem_io
+static void j_push(u32 cycles)
+{
+    x_rr(0x89, RDI, J_SP);
+    x_ri32(1, RDI, STACK_START);
+    x_ri8(5, J_SP, 1);
+    x_mov32i(RDX, cycles);
+    x_call((u64)jit_write);
+}
+static void j_pop(u32 cycles)
+{
+    x_ri8(0, J_SP, 1);
+    x_rr(0x89, RDI, J_SP);
+    x_ri32(1, RDI, STACK_START);
+    x_mov32i(RSI, cycles);
+    x_call((u64)jit_read);
+}
+
+//conditional branch, taken if (flags & mask) matches cc
+static void j_branch(const ins_t* ins, u8 mask, u8 cc)
+{
+    x_mov32i(J_PC, ins->next);
+    x_mov32i(RAX, ins->arg);
+    x_rex(0, 0, 0, J_F); x_byte(0xF6); x_modrm(3, 0, J_F); x_byte(mask);
+    x_cmov(cc, J_PC, RAX);
+}
+
+//does the instruction go through memory, mem_io may ask the core to stop after it
+static u8 jit_memory(u8 op)
+{
+    return op == OPIA_LDA || op == OPRAX_LDA || op == OPRAY_LDA || op == OPIA_STA ||
+           op == OP_PUA   || op == OP_PPA    || op == OP_CAL    || op == OP_RET;
+}
+
+//guest flags an instruction sets
+static u8 jit_flags_set(u8 op)
+{
+    switch(op)
+    {
+        case OP_ADX: case OP_ADY: case OPIV_ADD: case OP_INA: case OP_INX: case OP_INY:
+        {
+            return 1 << CPU_ZERO | 1 << CPU_OVERFLOW;
+        }
+        case OP_SUX: case OP_SUY: case OPIV_SUB: case OP_CMP: case OP_CMX: case OP_CMY: case OP_DEA: case OP_DEX: case OP_DEY:
+        {
+            return 1 << CPU_ZERO | 1 << CPU_UNDERFLOW;
+        }
+        case OP_XOR: case OP_AND: case OP_AOR: case OPIV_LDA: case OPIV_LDX: case OPIV_LDY: case OP_TXA: case OP_TYA: case OP_TAX:
+        case OP_TYX: case OP_TAY: case OP_TXY: case OP_INV: case OP_SAL: case OP_SAR: case OP_ROR: case OP_ROL:
+        case OPIA_LDA: case OPRAX_LDA: case OPRAY_LDA: case OP_PPA:
+        {
+            return 1 << CPU_ZERO;
+        }
+        default: { return 0; }
+    }
+}
+
+//guest flags a branch reads
+static u8 jit_flags_read(u8 op)
+{
+    switch(op)
+    {
+        case OP_BIE: case OP_BNE: { return 1 << CPU_ZERO;      }
+        case OP_BIN: case OP_BIP: { return 1 << CPU_UNDERFLOW; }
+        default:                  { return 0;                  }
+    }
+}
+
+//jump to the shared leave stub
+static void j_leave()
+{
+    x_mov64i(RAX, (u64)jit.leave);
+    x_byte(0xFF); x_modrm(3, 4, RAX);
+}
+
+static void jit_init()
+{
+    jit.base = mmap(NULL, JIT_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    jit.used = 0;
+    
+    //no executable memory, interpret everything
+    if(jit.base == MAP_FAILED) { jit.base = NULL; return; }
+    
+    //enter: keep the stack aligned for the helper calls, load the guest registers, jump to the block in RDI
+    jit.p     = jit.base;
+    jit.enter = jit.p;
+    x_push(RBX); x_push(RBP); x_push(R12); x_push(R13); x_push(R14); x_push(R15);
+    x_rex(1, 0, 0, RSP); x_byte(0x83); x_modrm(3, 5, RSP); x_byte(8);
+    
+    x_mov64i(RAX, (u64)&cpu);
+    x_load8(J_A,  RAX, offsetof(cpu_t, A));
+    x_load8(J_X,  RAX, offsetof(cpu_t, X));
+    x_load8(J_Y,  RAX, offsetof(cpu_t, Y));
+    x_load8(J_SP, RAX, offsetof(cpu_t, SP));
+    x_load8(J_F,  RAX, offsetof(cpu_t, flags));
+    x_byte(0xFF); x_modrm(3, 4, RDI);
+    
+    //leave: write the guest registers back
+    jit.leave = jit.p;
+    x_mov64i(RAX, (u64)&cpu);
+    x_store8 (RAX, offsetof(cpu_t, A),     J_A);
+    x_store8 (RAX, offsetof(cpu_t, X),     J_X);
+    x_store8 (RAX, offsetof(cpu_t, Y),     J_Y);
+    x_store8 (RAX, offsetof(cpu_t, SP),    J_SP);
+    x_store8 (RAX, offsetof(cpu_t, flags), J_F);
+    x_store16(RAX, offsetof(cpu_t, PC),    J_PC);
+    
+    x_rex(1, 0, 0, RSP); x_byte(0x83); x_modrm(3, 0, RSP); x_byte(8);
+    x_pop(R15); x_pop(R14); x_pop(R13); x_pop(R12); x_pop(RBP); x_pop(RBX);
+    x_byte(0xC3);
+    
+    jit.stubs = jit.used = jit.p - jit.base;
+}
+
+//translate a block, returns 0 if it contains something only the interpreter can do
+static u8 jit_compile(block_t* block)
+{
+    u8* exits[BLOCK_MAX_INS];
+    u32 exit_count = 0;
+    u32 cycles     = 0; //cycles of the block before the current instruction
+    
+    for(u32 i = 0; i < block->length; i++)
+    {
+        if(block->ins[i].op == OP_INT)                                             { return 0; }
+        if(block->ins[i].op == OP_DEBUG && block->ins[i].next == block->ins[i].pc) { return 0; }
+    }
+    
+    //flags read before they are set again, after each instruction
+    //all of them leave the block, possibly early after memory accesses
+    u8 live[BLOCK_MAX_INS];
+    u8 flags = CPU_LAZY_FLAGS;
+    
+    for(u32 i = block->length; i-- > 0; )
+    {
+        u8 op = block->ins[i].op;
+        
+        if(jit_memory(op)) { flags = CPU_LAZY_FLAGS; }
+        
+        live[i] = flags;
+        flags   = (flags & ~jit_flags_set(op)) | jit_flags_read(op);
+    }
+    
+    jit.p = jit.base + jit.used;
+    block->code = jit.p;
+    
+    for(u32 i = 0; i < block->length; i++)
+    {
+        const ins_t* ins    = &block->ins[i];
+        u8           memory = jit_memory(ins->op);
+        
+        switch(ins->op)
+        {
+            case OP_ADX:     { x_rr(0x00, J_A, J_X); j_flags(CPU_OVERFLOW, live[i]);  break; }
+            case OP_ADY:     { x_rr(0x00, J_A, J_Y); j_flags(CPU_OVERFLOW, live[i]);  break; }
+            case OP_SUX:     { x_rr(0x28, J_A, J_X); j_flags(CPU_UNDERFLOW, live[i]); break; }
+            case OP_SUY:     { x_rr(0x28, J_A, J_Y); j_flags(CPU_UNDERFLOW, live[i]); break; }
+            
+            case OPIV_ADD:   { x_ri8(0, J_A, ins->arg); j_flags(CPU_OVERFLOW, live[i]);  break; }
+            case OPIV_SUB:   { x_ri8(5, J_A, ins->arg); j_flags(CPU_UNDERFLOW, live[i]); break; }
+            case OP_CMP:     { x_ri8(7, J_A, ins->arg); j_flags(CPU_UNDERFLOW, live[i]); break; }
+            case OP_CMX:     { x_ri8(7, J_X, ins->arg); j_flags(CPU_UNDERFLOW, live[i]); break; }
+            case OP_CMY:     { x_ri8(7, J_Y, ins->arg); j_flags(CPU_UNDERFLOW, live[i]); break; }
+            
+            case OP_INA:     { x_ri8(0, J_A, 1); j_flags(CPU_OVERFLOW, live[i]);  break; }
+            case OP_INX:     { x_ri8(0, J_X, 1); j_flags(CPU_OVERFLOW, live[i]);  break; }
+            case OP_INY:     { x_ri8(0, J_Y, 1); j_flags(CPU_OVERFLOW, live[i]);  break; }
+            case OP_DEA:     { x_ri8(5, J_A, 1); j_flags(CPU_UNDERFLOW, live[i]); break; }
+            case OP_DEX:     { x_ri8(5, J_X, 1); j_flags(CPU_UNDERFLOW, live[i]); break; }
+            case OP_DEY:     { x_ri8(5, J_Y, 1); j_flags(CPU_UNDERFLOW, live[i]); break; }
+            
+            case OP_XOR:     { x_ri8(6, J_A, ins->arg); j_flags(-1, live[i]); break; }
+            case OP_AND:     { x_ri8(4, J_A, ins->arg); j_flags(-1, live[i]); break; }
+            case OP_AOR:     { x_ri8(1, J_A, ins->arg); j_flags(-1, live[i]); break; }
+            
+            case OPIV_LDA:   { x_mov8i(J_A, ins->arg); j_zero(ins->arg, live[i]); break; }
+            case OPIV_LDX:   { x_mov8i(J_X, ins->arg); j_zero(ins->arg, live[i]); break; }
+            case OPIV_LDY:   { x_mov8i(J_Y, ins->arg); j_zero(ins->arg, live[i]); break; }
+            
+            case OP_TXA:     { x_rr(0x88, J_A, J_X); x_rr(0x84, J_A, J_A); j_flags(-1, live[i]); break; }
+            case OP_TYA:     { x_rr(0x88, J_A, J_Y); x_rr(0x84, J_A, J_A); j_flags(-1, live[i]); break; }
+            case OP_TAX:     { x_rr(0x88, J_X, J_A); x_rr(0x84, J_X, J_X); j_flags(-1, live[i]); break; }
+            case OP_TYX:     { x_rr(0x88, J_X, J_Y); x_rr(0x84, J_X, J_X); j_flags(-1, live[i]); break; }
+            case OP_TAY:     { x_rr(0x88, J_Y, J_A); x_rr(0x84, J_Y, J_Y); j_flags(-1, live[i]); break; }
+            case OP_TXY:     { x_rr(0x88, J_Y, J_X); x_rr(0x84, J_Y, J_Y); j_flags(-1, live[i]); break; }
+            
+            //shifts by 0 leave the host flags alone, test the result instead
+            case OP_INV:     { x_grp8(0xF6, 2, J_A);                   x_rr(0x84, J_A, J_A); j_flags(-1, live[i]); break; }
+            case OP_SAL:     { x_grp8(0xC0, 4, J_A); x_byte(ins->arg); x_rr(0x84, J_A, J_A); j_flags(-1, live[i]); break; }
+            case OP_SAR:     { x_grp8(0xC0, 5, J_A); x_byte(ins->arg); x_rr(0x84, J_A, J_A); j_flags(-1, live[i]); break; }
+            case OP_ROR:     { x_grp8(0xD0, 1, J_A);                   x_rr(0x84, J_A, J_A); j_flags(-1, live[i]); break; }
+            case OP_ROL:     { x_grp8(0xD0, 0, J_A);                   x_rr(0x84, J_A, J_A); j_flags(-1, live[i]); break; }
+            
+            case OPIA_LDA:
+            case OPRAX_LDA:
+            case OPRAY_LDA:
+            {
+                x_mov32i(RDI, ins->arg);
+                if(ins->op != OPIA_LDA)
+                {
+                    x_rr(0x01, RDI, ins->op == OPRAX_LDA ? J_X : J_Y);
+                    x_ri32(4, RDI, 0xFFFF);
+                }
+                j_read(cycles);
+                x_movzx8(J_A, RAX); x_rr(0x84, J_A, J_A); j_flags(-1, live[i]);
+                break;
+            }
+            case OPIA_STA:   { x_mov32i(RDI, ins->arg); x_rr(0x89, RSI, J_A); j_write(cycles); break; }
+            
+            case OP_PUA:     { x_rr(0x89, RSI, J_A); j_push(cycles); break; }
+            case OP_PPA:     { j_pop(cycles); x_movzx8(J_A, RAX); x_rr(0x84, J_A, J_A); j_flags(-1, live[i]); break; }
+            
+            case OP_BIE:     { j_branch(ins, 1 << CPU_ZERO,      CC_NZ); break; }
+            case OP_BNE:     { j_branch(ins, 1 << CPU_ZERO,      CC_Z);  break; }
+            case OP_BIN:     { j_branch(ins, 1 << CPU_UNDERFLOW, CC_NZ); break; }
+            case OP_BIP:     { j_branch(ins, 1 << CPU_UNDERFLOW, CC_Z);  break; }
+            case OP_JMP:     { x_mov32i(J_PC, ins->arg); break; }
+            
+            case OP_CAL:
+            {
+                x_mov32i(RSI, ins->next >> 8);   j_push(cycles);
+                x_mov32i(RSI, ins->next & 0xFF); j_push(cycles);
+                x_mov32i(J_PC, ins->arg);
+                break;
+            }
+            case OP_RET:
+            {
+                j_pop(cycles); x_rr(0x89, J_PC, RAX); x_shift(4, J_PC, 8);
+                j_pop(cycles); x_rr(0x09, J_PC, RAX);
+                break;
+            }
+            
+            default: { break; } //NOP and undefined opcodes
+        }
+        
+        cycles += ins->cycles;
+        
+        //mem_io may have asked the core to stop (self-modifying code), leave after this instruction
+        if(memory && i + 1 < block->length)
+        {
+            x_mov64i(RAX, (u64)&cpu_deadline);
+            x_rex(1, 0, 0, RAX); x_byte(0x83); x_modrm(0, 7, RAX); x_byte(0);
+            u8* go_on = x_jcc8(CC_NZ);
+            x_mov32i(J_PC, ins->next);
+            x_mov32i(RDI, cycles);
+            x_mov32i(RSI, i + 1);
+            exits[exit_count++] = x_jmp32();
+            x_land8(go_on);
+        }
+    }
+    
+    if(!block_ends(block->ins[block->length - 1].op)) { x_mov32i(J_PC, block->end); }
+    x_mov32i(RDI, cycles);
+    x_mov32i(RSI, block->length);
+    
+    //charge the cycles (EDI) the helpers have not, count the instructions (ESI)
+    for(u32 i = 0; i < exit_count; i++) { x_land32(exits[i]); }
+    x_mov64i(RAX, (u64)&jit.charged);
+    x_rex(0, RDI, 0, RAX); x_byte(0x2B); x_modrm(0, RDI, RAX);
+    x_byte(0xC7); x_modrm(0, 0, RAX); x_dword(0);
+    x_mov64i(RAX, (u64)&cpu.cycles);       x_mem64(0x01, RDI, RAX);
+    x_mov64i(RAX, (u64)&cpu.instructions); x_mem64(0x01, RSI, RAX);
+    
+    //chain: the block at the new PC has to be translated and fit before the deadline
+    x_movzx16(RAX, J_PC);
+    x_mov64i(RDX, (u64)block_cache.map);
+    x_rex(0, RAX, RAX, RDX); x_byte(0x0F); x_byte(0xB7); x_modrm(0, RAX, 4); x_sib(1, RAX, RDX);
+    x_rr(0x85, RAX, RAX);
+    u8* unmapped = x_jcc8(CC_Z);
+    
+    x_byte(0x69); x_modrm(3, RAX, RAX); x_dword(sizeof(block_t));
+    x_mov64i(RDX, (u64)block_cache.blocks - sizeof(block_t));
+    x_rr64(0x01, RAX, RDX);
+    x_rex(1, RCX, 0, RAX); x_byte(0x8B); x_modrm(2, RCX, RAX); x_dword(offsetof(block_t, code));
+    x_rr64(0x85, RCX, RCX);
+    u8* untranslated = x_jcc8(CC_Z);
+    
+    x_rex(0, RDX, 0, RAX); x_byte(0x8B); x_modrm(2, RDX, RAX); x_dword(offsetof(block_t, cycles));
+    x_mov64i(RSI, (u64)&cpu.cycles);   x_mem64(0x03, RDX, RSI);
+    x_mov64i(RSI, (u64)&cpu_deadline); x_mem64(0x3B, RDX, RSI);
+    u8* too_long = x_jcc8(CC_A);
+    x_byte(0xFF); x_modrm(3, 4, RCX);
+    
+    x_land8(unmapped);
+    x_land8(untranslated);
+    x_land8(too_long);
+    j_leave();
+    
+    jit.used = jit.p - jit.base;
+    
+    return 1;
+}
+
+//run the block at the PC natively, returns 0 if the interpreter has to take it
+static u8 jit_run()
+{
+    //decoding fetches from the I/O page, leave it to the interpreter to do that once
+    if(block_in_io(cpu.PC)) { return 0; }
+    
+    //only the interpreter records the trace
+    if(trace.on) { return 0; }
+    
+    block_t* block = block_get(cpu.PC);
+    
+    if(block->code == NULL)
+    {
+        if(jit.base == NULL || block->no_jit) { return 0; }
+        if(block->runs < JIT_HOT)             { block->runs++; return 0; }
+        
+        //out of code space, start over
+        if(jit.used + JIT_MAX_BLOCK > JIT_SIZE) { block_flush(); jit.used = jit.stubs; return 0; }
+        
+        if(!jit_compile(block)) { block->no_jit = 1; return 0; }
+    }
+    
+    //nothing may interrupt the block halfway
+    if(cpu.cycles + block->cycles > cpu_deadline) { return 0; }
+    
+    //native code keeps the flags evaluated
+    jit.charged = 0;
+    cpu.flags   = cpu_get_flags();
+    ((void (*)(u8*))(u64)jit.enter)(block->code);
+    cpu_set_flags(cpu.flags);
+    
+    return 1;
+}
+
+#endif
+
+
+//every opcode handled by the core
+#define CPU_OPS(X)                                                                              \
+    X(OP_NOP)   X(OP_ADX)   X(OP_ADY)   X(OP_SUX)   X(OP_SUY)   X(OPIV_LDA)  X(OPIA_STA)  X(OPIV_ADD) \
+    X(OPIV_SUB) X(OP_INA)   X(OP_INX)   X(OP_INY)   X(OP_DEA)   X(OP_DEX)    X(OP_DEY)    X(OP_PUA)   \
+    X(OP_PPA)   X(OP_CMP)   X(OP_BIE)   X(OP_BIN)   X(OP_BIP)   X(OP_JMP)    X(OP_CAL)    X(OP_RET)   \
+    X(OP_XOR)   X(OP_INT)   X(OPIA_LDA) X(OPIV_LDX) X(OPIV_LDY) X(OPRAX_LDA) X(OPRAY_LDA) X(OP_TXA)   \
+    X(OP_TYA)   X(OP_AND)   X(OP_INV)   X(OP_SAL)   X(OP_SAR)   X(OP_ROR)    X(OP_ROL)    X(OP_TAX)   \
+    X(OP_TAY)   X(OP_TXY)   X(OP_TYX)   X(OP_CMX)   X(OP_CMY)   X(OP_BNE)    X(OP_AOR)   \
+    X(OP_DEBUG)
+
+#define CPU_TRACE() if(trace.on) { trace_ins(ins); }
+
+#ifdef PROFILE
+#define CPU_PROFILE() profile_ins(ins);
+#else
+#define CPU_PROFILE()
+#endif
+
+//labels as values are a GNU extension, other compilers get the switch core
+//the JIT drives the switch core between native blocks
+#if defined(CPU_THREADED) && (!defined(__GNUC__) || defined(CPU_JIT))
+#undef CPU_THREADED
+#endif
+
+//operands of the current instruction
+#define ARG8()  ((u8)ins->arg)
+#define ARG16() (ins->arg)
+
+//fetch the next predecoded instruction, blocks end where the PC leaves the straight line
+#define FETCH()                                                                                 \
+    if(ins == end)                                                                              \
+    {                                                                                           \
+        block_t* block = block_get(cpu.PC);                                                     \
+        ins = block->ins; end = ins + block->length;                                            \
+    }                                                                                           \
+    cpu.PC = ins->next;                                                                         \
+    cpu.instructions++;                                                                         \
+    CPU_TRACE();                                                                                \
+    CPU_PROFILE();
+
+#ifdef CPU_THREADED
+//threaded code: every handler dispatches the next instruction itself
+#define OP(name) L_##name:
+#define NEXT()                                              \
+    cpu.cycles += ins->cycles;                              \
+    ins++;                                                  \
+    if(cpu.cycles >= cpu_deadline) { return; }              \
+    FETCH();                                                \
+    goto *dispatch_table[ins->op];
+#else
+//switch core: one shared dispatch point
+#define OP(name) case name:
+#define NEXT()   break;
+#endif
+
+//execute instructions until cpu.cycles reaches cpu_deadline
+//or something asks the core to stop (cpu_deadline = 0)
+static void cpu_exec()
+{
+    //the first fetch looks up the block at the PC
+    const ins_t* ins = NULL;
+    const ins_t* end = NULL;
+    
+//flags are only recorded here, see cpu_get_flags()
+#define CHECK_OVERFLOW(x, y)  cpu.overflow  = (x) + (y);
+#define CHECK_UNDERFLOW(x, y) cpu.underflow = (x) - (y);
+#define CHECK_ZERO(x)         cpu.zero      = (x);
+    
+#ifdef CPU_THREADED
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#pragma GCC diagnostic ignored "-Woverride-init"
+    //constant, threads running their own machines share it
+    static void* const dispatch_table[256] =
+    {
+        [0 ... 255] = &&L_OP_NOP,
+#define X(name) [name] = &&L_##name,
+        CPU_OPS(X)
+#undef X
+    };
+    
+    if(cpu.cycles >= cpu_deadline) { return; }
+    
+    //fetch the first instruction
+    FETCH();
+    goto *dispatch_table[ins->op];
+    {
+#else
+    while(cpu.cycles < cpu_deadline)
+    {
+#ifdef CPU_JIT
+        //whole blocks run natively where possible
+        if(ins == end && jit_run()) { continue; }
+#endif
+        
+        //fetch the instruction
+        FETCH();
+        
+        //execute op code
+        switch(ins->op)
+        {
+#endif
+        OP(OP_NOP)   { NEXT(); }
+            
+        OP(OP_ADX)   { CHECK_OVERFLOW(cpu.A, cpu.X); cpu.A += cpu.X; CHECK_ZERO(cpu.A); NEXT(); }
+        OP(OP_ADY)   { CHECK_OVERFLOW(cpu.A, cpu.Y); cpu.A += cpu.Y; CHECK_ZERO(cpu.A); NEXT(); }
+            
+        OP(OP_SUX)   { CHECK_UNDERFLOW(cpu.A, cpu.X) cpu.A -= cpu.X; CHECK_ZERO(cpu.A); NEXT(); }
+        OP(OP_SUY)   { CHECK_UNDERFLOW(cpu.A, cpu.Y) cpu.A -= cpu.Y; CHECK_ZERO(cpu.A); NEXT(); }
+        
+        OP(OPIV_LDA) { cpu.A = ARG8(); CHECK_ZERO(cpu.A); NEXT(); }
+        OP(OPIA_LDA)
+        {
+            cpu.A = RB(ARG16());
+            CHECK_ZERO(cpu.A); NEXT();
+        }
+        OP(OPRAX_LDA)
+        {
+            cpu.A = RB(ARG16() + cpu.X);
+            CHECK_ZERO(cpu.A); NEXT();
+        }
+            
+        OP(OPRAY_LDA)
+        {
+            cpu.A = RB(ARG16() + cpu.Y);
+            CHECK_ZERO(cpu.A); NEXT();
+        }
+            
+        OP(OPIA_STA)
+        {
+            WB(ARG16(), cpu.A);
+            NEXT();
+        }
+            
+        OP(OPIV_ADD) { u8 arg = ARG8(); CHECK_OVERFLOW(cpu.A, arg);  cpu.A += arg; CHECK_ZERO(cpu.A); NEXT(); }
+        OP(OPIV_SUB) { u8 arg = ARG8(); CHECK_UNDERFLOW(cpu.A, arg); cpu.A -= arg; CHECK_ZERO(cpu.A); NEXT(); }
+            
+        OP(OP_INA) { CHECK_OVERFLOW(cpu.A, 1); cpu.A++; CHECK_ZERO(cpu.A); NEXT(); }
+        OP(OP_INX) { CHECK_OVERFLOW(cpu.X, 1); cpu.X++; CHECK_ZERO(cpu.X); NEXT(); }
+        OP(OP_INY) { CHECK_OVERFLOW(cpu.Y, 1); cpu.Y++; CHECK_ZERO(cpu.Y); NEXT(); }
+            
+        OP(OP_DEA) { CHECK_UNDERFLOW(cpu.A, 1); cpu.A--; CHECK_ZERO(cpu.A); NEXT(); }
+        OP(OP_DEX) { CHECK_UNDERFLOW(cpu.X, 1); cpu.X--; CHECK_ZERO(cpu.X); NEXT(); }
+        OP(OP_DEY) { CHECK_UNDERFLOW(cpu.Y, 1); cpu.Y--; CHECK_ZERO(cpu.Y); NEXT(); }
+          
+        OP(OP_PUA) { push(cpu.A);                      NEXT(); }
+        OP(OP_PPA) { cpu.A = pop(); CHECK_ZERO(cpu.A); NEXT(); }
+            
+        OP(OP_CMP) { u8 arg = ARG8(); CHECK_UNDERFLOW(cpu.A, arg); CHECK_ZERO(cpu.A - arg); NEXT(); }
+            
+        //the PC already points past the operand, not taken branches fall through
+        OP(OP_BIE) { if(cpu.zero == 0)         { cpu.PC = ARG16(); } NEXT(); }
+        OP(OP_BNE) { if(cpu.zero != 0)         { cpu.PC = ARG16(); } NEXT(); }
+        OP(OP_BIN) { if(cpu.underflow >  0xFF) { cpu.PC = ARG16(); } NEXT(); }
+        OP(OP_BIP) { if(cpu.underflow <= 0xFF) { cpu.PC = ARG16(); } NEXT(); }
+        OP(OP_JMP) { cpu.PC = ARG16(); NEXT(); }
+            
+        OP(OP_CAL)
+        {
+            u16 address = ARG16();
+            push(cpu.PC >> 8);
+            push(cpu.PC);
+            cpu.PC      = address;
+            NEXT();
+        }
+        OP(OP_RET) { u16 high = pop(); cpu.PC = (high << 8) | pop(); NEXT(); }
+            
+        OP(OP_XOR) { cpu.A ^= ARG8(); CHECK_ZERO(cpu.A); NEXT(); }
+            
+        OP(OP_INT)
+        {
+            u8 arg = ARG8();
+            
+            switch(arg)
+            {
+                case 0x01: { SET_BIT(cpu.flags, CPU_TERMINATE); cpu_deadline = 0; break; }
+                case 0x10: { fputc(cpu.A, output);                                break; } //TODO: replace with my gpu implementation
+                default: { break; }
+            }
+            
+            NEXT();
+        }
+            
+        OP(OPIV_LDX) { cpu.X = ARG8(); CHECK_ZERO(cpu.X); NEXT(); }
+            
+        OP(OPIV_LDY) { cpu.Y = ARG8(); CHECK_ZERO(cpu.Y); NEXT(); }
+            
+        OP(OP_TXA) { cpu.A = cpu.X; CHECK_ZERO(cpu.A); NEXT(); }
+        OP(OP_TYA) { cpu.A = cpu.Y; CHECK_ZERO(cpu.A); NEXT(); }
+        OP(OP_TAX) { cpu.X = cpu.A; CHECK_ZERO(cpu.X); NEXT(); }
+        OP(OP_TYX) { cpu.X = cpu.Y; CHECK_ZERO(cpu.X); NEXT(); }
+        OP(OP_TAY) { cpu.Y = cpu.A; CHECK_ZERO(cpu.Y); NEXT(); }
+        OP(OP_TXY) { cpu.Y = cpu.X; CHECK_ZERO(cpu.Y); NEXT(); }
+            
+        OP(OP_AND) { cpu.A &= ARG8();  CHECK_ZERO(cpu.A); NEXT(); }
+        OP(OP_INV) { cpu.A = ~cpu.A;   CHECK_ZERO(cpu.A); NEXT(); }
+        OP(OP_SAL) { cpu.A <<= ARG8(); CHECK_ZERO(cpu.A); NEXT(); }
+        OP(OP_SAR) { cpu.A >>= ARG8(); CHECK_ZERO(cpu.A); NEXT(); }
+        OP(OP_AOR) { cpu.A |= ARG8();  CHECK_ZERO(cpu.A); NEXT(); }
+            
+        OP(OP_ROR) { cpu.A = (cpu.A << 7) | (cpu.A >> 1); CHECK_ZERO(cpu.A); NEXT(); }
+        OP(OP_ROL) { cpu.A = (cpu.A >> 7) | (cpu.A << 1); CHECK_ZERO(cpu.A); NEXT(); }
+            
+        OP(OP_CMX) { u8 arg = ARG8(); CHECK_UNDERFLOW(cpu.X, arg); CHECK_ZERO(cpu.X - arg); NEXT(); }
+        OP(OP_CMY) { u8 arg = ARG8(); CHECK_UNDERFLOW(cpu.Y, arg); CHECK_ZERO(cpu.Y - arg); NEXT(); }
+            
+        //breakpoint, 0xFF bytes of the program are NOPs
+        OP(OP_DEBUG)
+        {
+            if(ins->next == ins->pc)
+            {
+                cpu.instructions--;
+                if(debug.skip) { debug.skip = 0; } else { debug_stop(DEBUG_BREAK); }
+            }
+            NEXT();
+        }
+            
+#ifdef CPU_THREADED
+    }
+#pragma GCC diagnostic pop
+#else
+            default: { break; }
+        }
+        
+        //emulate op cycles, the gpu catches up later
+        cpu.cycles += ins->cycles;
+        
+        ins++;
+    }
+#endif
+}
+
+//bring the gpu up to the current cpu cycle
+//1 cpu cycle = 3 gpu ticks
+void gpu_catch_up()
+{
+    u64 run = cpu.cycles - gpu.cycles;
+    
+    gpu.cycles = cpu.cycles;
+    gpu_run(run * 3);
+}
+
+//run until cpu.cycles reaches cycle_limit, a frame is finished, the cpu terminates or the debugger stops it
+//the cpu runs freely up to the next gpu event, then the gpu catches up in bulk
+void cpu_run(u64 cycle_limit)
+{
+    u64 frames = gpu.frames;
+    
+    while(cpu.cycles < cycle_limit)
+    {
+        u64 event = gpu_next_event();
+        
+        cpu_deadline = event < cycle_limit ? event : cycle_limit;
+        cpu_exec();
+        gpu_catch_up();
+        
+        if(gpu.frames != frames || GET_BIT(cpu.flags, CPU_TERMINATE) || debug.stop) { break; }
+    }
+}
+
+#undef OP
+#undef NEXT
+#undef FETCH
+#undef ARG8
+#undef ARG16
+
+/*****************/
+//PALETTE EXPANSION
+/*****************/
+
+//indexed frame to RGBA8888, once per frame right before it is shown
+//the gpu knows 64 colors, index bytes wrap around the palette
+//SSE2 has no byte shuffle or gather, without AVX2 the plain lookup is the fastest
+static u32 palette_rgba[256];
+
+static void expand_scalar(u32* out, const u8* in, u32 count)
+{
+    for(u32 i = 0; i < count; i++) { out[i] = palette_rgba[in[i]]; }
+}
+
+#ifdef EXPAND_AVX2
+//eight pixels per gather, compiled for AVX2 and picked at runtime
+__attribute__((target("avx2")))
+static void expand_avx2(u32* out, const u8* in, u32 count)
+{
+    for(u32 i = 0; i < count; i += 8)
+    {
+        __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(in + i)));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_i32gather_epi32((const int*)palette_rgba, index, 4));
+    }
+}
+#endif
+
+//count must be a multiple of 8
+static void (*expand)(u32* out, const u8* in, u32 count) = expand_scalar;
+
+static void expand_init()
+{
+    for(u32 i = 0; i < 256; i++) { palette_rgba[i] = VGA_PALLETTE[i % 64]; }
+    
+#ifdef EXPAND_AVX2
+    if(__builtin_cpu_supports("avx2")) { expand = expand_avx2; }
+#endif
+}
+
+/*****************/
+//EMULATOR
+/*****************/
+
+static u64 frame_budget = 0; //stop after n frames (0 = no limit)
+static u64 cycle_budget = 0; //stop after n cpu cycles (0 = no limit)
+
+//frontends run between frames, nothing frontend related runs inside a frame
+typedef struct
+{
+    void (*init) ();
+    void (*frame)(); //present the finished frame and update the controllers
+    void (*quit) ();
+    void (*run)  (); //emu_run, on whatever thread the frontend wants it
+} frontend_t;
+
+static const frontend_t* frontend;
+static u8                headless = 0; //no window (headless and scripted frontends)
+
+//tables shared by all machines, built once before the first machine
+void emu_setup()
+{
+    cpu_init();
+    expand_init();
+}
+
+//create a machine and make it the calling thread's machine
+void emu_init()
+{
+    emu = calloc(1, sizeof(emu_t));
+    
+    output = stdout;
+    
+    cpu.PC     = ROM_START;
+    cpu.SP     = 0xff;
+    cpu.cycles = 0;
+    cpu_set_flags(0);
+    
+    
+    gpu.ctrl       = 0;
+    gpu.sdata      = 0x0300;
+    gpu.tick_index = 0;
+    gpu.vblank     = 0;
+    gpu.frames     = 0;
+    gpu.cycles     = 0;
+    
+    //the beam starts on pixel 0, it is drawn after the first wrap
+    gpu.render_index = 1;
+    sprite_list.y    = SCR_HEIGHT;
+    
+    gpu.default_background_color = 0x3F;
+    
+    gpu.palette_index  = 0;
+    gpu.write_reg_high = 1; //big endian
+    
+    gpu.scroll_x = gpu.scroll_y = 0;
+    
+    mem_map_init();
+#ifdef CPU_JIT
+    jit_init();
+#endif
+    
+    pixels   = calloc(SCR_WIDTH * SCR_HEIGHT, sizeof(u8));
+    
+    frontend->init();
+}
+
+//free emulator resources
+void emu_quit()
+{
+    frontend->quit();
+    trace_close();
+    
+    free(pixels);
+    
+#ifdef CPU_JIT
+    if(jit.base) { munmap(jit.base, JIT_SIZE); }
+#endif
+    
+    free(emu);
+    emu = NULL;
+}
+
+//load ROM, the machine starts on its first page
+//code switching pages has to run from RAM or exist at the same address in both pages
+//the image is read in place and has to outlive the machine
+void emu_load(u8* image, u8 pages)
+{
+    cart_buffer   = image;
+    cart_page_max = pages;
+    cart_page     = 0;
+    
+    mem_map_rom();
+}
+
+/*
+ * ROM LAYOUT *
+ * header - 3 byte = { 'C', 'M', 'U' }
+ *          1 byte = number of pages
+ * data   - at most number of pages * ROM_PAGE_SIZE bytes, a short last page reads as zeros
+ */
+#define ROM_HEADER_SIZE 4
+
+//cartridge image, pages back to back after the header
+typedef struct
+{
+    u8* base;   //header and all pages
+    u64 length;
+    u8* data;   //first page
+    u32 size;   //data bytes in the file
+    u8  pages;
+} rom_t;
+
+enum { ROM_OK, ROM_NO_FILE, ROM_BAD_HEADER };
+static const char* ROM_ERRORS[] = { "ok", "error opening file", "error reading ROM (not a CMU file or wrong page count)" };
+
+//does the file start with a valid header
+static u8 rom_check(const u8* header, u64 file_size)
+{
+    return file_size >= ROM_HEADER_SIZE && header[0] == 'C' && header[1] == 'M' && header[2] == 'U' && header[3] != 0 &&
+           file_size - ROM_HEADER_SIZE <= (u64)header[3] * ROM_PAGE_SIZE;
+}
+
+//open ROM file, returns ROM_OK or the error
+//mapped files are read only and shared with every process mapping the same file
+u8 rom_open(rom_t* rom, const char* path)
+{
+    u8 header[ROM_HEADER_SIZE];
+    
+#ifdef FILE_MMAP
+    struct stat info;
+    int         fd = open(path, O_RDONLY);
+    
+    if(fd < 0) { return ROM_NO_FILE; }
+    if(fstat(fd, &info) != 0 || read(fd, header, ROM_HEADER_SIZE) != ROM_HEADER_SIZE || !rom_check(header, info.st_size))
+    {
+        close(fd); return ROM_BAD_HEADER;
+    }
+    
+    rom->pages  = header[3];
+    rom->size   = info.st_size - ROM_HEADER_SIZE;
+    rom->length = ROM_HEADER_SIZE + (u64)rom->pages * ROM_PAGE_SIZE;
+    
+    //zero pages for the whole cartridge, the file is mapped over their start
+    rom->base = mmap(NULL, rom->length, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    
+    if(rom->base != MAP_FAILED && mmap(rom->base, info.st_size, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(rom->base, rom->length);
+        rom->base = MAP_FAILED;
+    }
+    close(fd);
+    
+    if(rom->base == MAP_FAILED) { return ROM_NO_FILE; }
+#else
+    FILE* in = fopen(path, "rb");
+    
+    if(in == NULL) { return ROM_NO_FILE; }
+    
+    fseek(in, 0, SEEK_END);
+    u64 file_size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    
+    if(fread(header, sizeof(char), ROM_HEADER_SIZE, in) != ROM_HEADER_SIZE || !rom_check(header, file_size))
+    {
+        fclose(in); return ROM_BAD_HEADER;
+    }
+    
+    rom->pages  = header[3];
+    rom->size   = file_size - ROM_HEADER_SIZE;
+    rom->length = ROM_HEADER_SIZE + (u64)rom->pages * ROM_PAGE_SIZE;
+    rom->base   = calloc(1, rom->length);
+    
+    memcpy(rom->base, header, ROM_HEADER_SIZE);
+    rom->size = fread(rom->base + ROM_HEADER_SIZE, sizeof(char), rom->size, in);
+    fclose(in);
+#endif
+    
+    rom->data = rom->base + ROM_HEADER_SIZE;
+    
+    return ROM_OK;
+}
+
+void rom_close(rom_t* rom)
+{
+#ifdef FILE_MMAP
+    munmap(rom->base, rom->length);
+#else
+    free(rom->base);
 #endif
 }
 
+//64-bit FNV-1a hash
+static u64 fnv1a(const void* data, u64 size)
+{
+    const u8* bytes = data;
+    u64       hash  = 0xcbf29ce484222325ULL;
+    
+    for(u64 i = 0; i < size; i++) { hash = (hash ^ bytes[i]) * 0x100000001b3ULL; }
+    
+    return hash;
+}
+
+//print final machine state
+void emu_summary(FILE* out, double seconds)
+{
+    //draw the part of the frame the beam has passed
+    gpu_sync();
+    
+    fprintf(out, "frames:  %llu\n", gpu.frames);
+    fprintf(out, "cycles:  %llu\n", cpu.cycles);
+    fprintf(out, "cpu:     (A: %u) (X: %u) (Y: %u) (PC: %u) (SP: %u) (flags: %u%u%u%u%u%u%u%u)\n",
+                 cpu.A, cpu.X, cpu.Y, cpu.PC, cpu.SP, !!GET_BIT(cpu_get_flags(), CPU_TERMINATE), 0, 0, 0, 0, !!GET_BIT(cpu_get_flags(), CPU_UNDERFLOW), !!GET_BIT(cpu_get_flags(), CPU_OVERFLOW), !!GET_BIT(cpu_get_flags(), CPU_ZERO));
+    fprintf(out, "gpu:     (ctrl: 0x%02x) (tick: %u) (vblank: %u) (scroll: %u, %u)\n",
+                 gpu.ctrl, gpu.tick_index, gpu.vblank, RAM[SCROLL_X], RAM[SCROLL_Y]);
+    fprintf(out, "ram:     %016llx\n", fnv1a(RAM, sizeof(RAM)));
+    u32* rgba = malloc(SCR_WIDTH * SCR_HEIGHT * sizeof(u32));
+    expand(rgba, pixels, SCR_WIDTH * SCR_HEIGHT);
+    fprintf(out, "screen:  %016llx\n", fnv1a(rgba, SCR_WIDTH * SCR_HEIGHT * sizeof(u32)));
+    free(rgba);
+    
+    if(seconds > 0)
+    {
+        fprintf(out, "time:    %.3f s (%.2f MHz, %.1f fps, %.2f ns/ins)\n", seconds, cpu.cycles / seconds / 1e6, gpu.frames / seconds,
+                     cpu.instructions ? seconds * 1e9 / cpu.instructions : 0.0);
+    }
+}
+
+//run until a budget is used up, the program terminates or a played movie ends
+void emu_run()
+{
+    //the first frame runs with the movie input as well
+    u8 playing = movie_frame();
+    
+    //the cpu returns after every frame
+    while(playing && !GET_BIT(cpu.flags, CPU_TERMINATE))
+    {
+        if(frame_budget && gpu.frames >= frame_budget) { break; }
+        if(cycle_budget && cpu.cycles >= cycle_budget) { break; }
+        
+        //breakpoint, watchpoint, finished step or F9
+        if(debug.stop) { debug_console(debug.stop); continue; }
+        
+        u64 frames = gpu.frames;
+        u64 limit  = cycle_budget ? cycle_budget : ~0ULL;
+        
+        //every instruction takes at least one cycle
+        if(debug.steps && cpu.cycles + 1 < limit) { limit = cpu.cycles + 1; }
+        
+        cpu_run(limit);
+        
+        if(debug.steps && --debug.steps == 0) { debug.stop = DEBUG_STEP; }
+        
+        //frame boundary, the frontend runs between frames
+        if(gpu.frames != frames) { frontend->frame(); playing = movie_frame(); }
+    }
+}
+
+/*****************/
+//SAVE STATES
+/*****************/
+
+/*
+ * STATE LAYOUT *
+ * little endian, STATE_SIZE bytes
+ * header - 4 byte  = { 'C', 'P', 'U', 'S' }
+ *          1 byte  = version
+ * cpu    - A, X, Y, SP, flags, PC, cycles
+ * gpu    - registers, beam position, frame and cycle counters
+ *          1 byte  = cartridge page
+ * memory - writable regions in state_regions order, of the I/O page only the controllers,
+ *          the stack has no backing memory, so there is nothing of it to save
+ *
+ * ROM is not stored, a state only loads into the emulator running the same ROM
+ * the framebuffer is not stored either, pixels drawn before the load stay until the beam redraws them
+ */
+#define STATE_VERSION 2
+
+static const struct { u16 start, size; } state_regions[] =
+{
+    { RAM_START,   RAM_SIZE                      }, //RAM, includes sprite data
+    { CONTROLLER0, CONTROLLER1 + 2 - CONTROLLER0 }, //controllers
+    { BKG_PAL_MAP, SCROLL_Y + 1 - BKG_PAL_MAP    }, //background maps, palettes and scroll
+};
+
+#define STATE_HEADER_SIZE 5
+#define STATE_CPU_SIZE    15
+#define STATE_GPU_SIZE    37
+#define STATE_MEMORY_SIZE (RAM_SIZE + CONTROLLER1 + 2 - CONTROLLER0 + SCROLL_Y + 1 - BKG_PAL_MAP)
+#define STATE_SIZE        (STATE_HEADER_SIZE + STATE_CPU_SIZE + STATE_GPU_SIZE + STATE_MEMORY_SIZE)
+
+static u8* state_put8 (u8* p, u8  v) { p[0] = v; return p + 1; }
+static u8* state_put16(u8* p, u16 v) { p[0] = v; p[1] = v >> 8; return p + 2; }
+static u8* state_put32(u8* p, u32 v) { for(u32 i = 0; i < 4; i++) { p[i] = v >> (i * 8); } return p + 4; }
+static u8* state_put64(u8* p, u64 v) { for(u32 i = 0; i < 8; i++) { p[i] = v >> (i * 8); } return p + 8; }
+
+static u8  state_get8 (const u8** p) { u8  v = (*p)[0];                  *p += 1; return v; }
+static u16 state_get16(const u8** p) { u16 v = (*p)[0] | (*p)[1] << 8;   *p += 2; return v; }
+static u32 state_get32(const u8** p) { u32 v = 0; for(u32 i = 0; i < 4; i++) { v |= (u32)(*p)[i] << (i * 8); } *p += 4; return v; }
+static u64 state_get64(const u8** p) { u64 v = 0; for(u32 i = 0; i < 8; i++) { v |= (u64)(*p)[i] << (i * 8); } *p += 8; return v; }
+
+//write the machine state into out, STATE_SIZE bytes
+//call between frames (or anywhere cpu_run is not running)
+void state_save(u8* out)
+{
+    u8* p = out;
+    
+    //the state holds what the beam has drawn so far
+    gpu_sync();
+    
+    memcpy(p, "CPUS", 4); p += 4;
+    p = state_put8 (p, STATE_VERSION);
+    
+    p = state_put8 (p, cpu.A);
+    p = state_put8 (p, cpu.X);
+    p = state_put8 (p, cpu.Y);
+    p = state_put8 (p, cpu.SP);
+    p = state_put8 (p, cpu_get_flags());
+    p = state_put16(p, cpu.PC);
+    p = state_put64(p, cpu.cycles);
+    
+    p = state_put16(p, gpu.sdata);
+    p = state_put8 (p, gpu.vblank);
+    p = state_put8 (p, gpu.write_reg_high);
+    p = state_put16(p, gpu.palette_index);
+    p = state_put16(p, gpu.sprtex_p);
+    p = state_put16(p, gpu.bkgtex_p);
+    p = state_put8 (p, gpu.ctrl);
+    p = state_put8 (p, gpu.default_background_color);
+    p = state_put32(p, gpu.tick_index);
+    p = state_put32(p, gpu.render_index);
+    p = state_put64(p, gpu.frames);
+    p = state_put64(p, gpu.cycles);
+    p = state_put8 (p, cart_page);
+    
+    for(u32 i = 0; i < sizeof(state_regions) / sizeof(state_regions[0]); i++)
+    {
+        memcpy(p, RAM + state_regions[i].start, state_regions[i].size); p += state_regions[i].size;
+    }
+}
+
+//restore a state written by state_save, returns 0 if it is not a state of this version
+u8 state_load(const u8* in, u32 size)
+{
+    const u8* p    = in;
+    u8        page = cart_page;
+    
+    if(size != STATE_SIZE || memcmp(p, "CPUS", 4) != 0 || p[4] != STATE_VERSION) { return 0; }
+    p += STATE_HEADER_SIZE;
+    
+    cpu.A  = state_get8(&p);
+    cpu.X  = state_get8(&p);
+    cpu.Y  = state_get8(&p);
+    cpu.SP = state_get8(&p);
+    cpu_set_flags(state_get8(&p));
+    cpu.PC     = state_get16(&p);
+    cpu.cycles = state_get64(&p);
+    
+    gpu.sdata                    = state_get16(&p);
+    gpu.vblank                   = state_get8 (&p);
+    gpu.write_reg_high           = state_get8 (&p);
+    gpu.palette_index            = state_get16(&p);
+    gpu.sprtex_p                 = state_get16(&p);
+    gpu.bkgtex_p                 = state_get16(&p);
+    gpu.ctrl                     = state_get8 (&p);
+    gpu.default_background_color = state_get8 (&p);
+    gpu.tick_index               = state_get32(&p);
+    gpu.render_index             = state_get32(&p);
+    gpu.frames                   = state_get64(&p);
+    gpu.cycles                   = state_get64(&p);
+    cart_page                    = state_get8 (&p);
+    
+    //copy memory, decoded blocks are only dropped where code really changed
+    for(u32 i = 0; i < sizeof(state_regions) / sizeof(state_regions[0]); i++)
+    {
+        u16 start = state_regions[i].start;
+        u16 size  = state_regions[i].size;
+        
+        for(u32 a = start; a < (u32)start + size; a++)
+        {
+            if(block_cache.code_pages[a >> 8] && RAM[a] != p[a - start]) { block_invalidate(a); }
+        }
+        
+        memcpy(RAM + start, p, size); p += size;
+    }
+    
+    //decoded ROM code belongs to the page the machine was on
+    if(cart_page_max) { cart_page %= cart_page_max; }
+    if(cart_page != page) { block_drop_rom(); }
+    
+    //everything derived from the restored state
+    memset(bkg_tiles.valid, 0, sizeof(bkg_tiles.valid));
+    memset(spr_tiles.valid, 0, sizeof(spr_tiles.valid));
+    sprite_list.y = SCR_HEIGHT;
+    
+    mem_map_rom();
+    mem_map_ram();
+    
+    return 1;
+}
+
+//save state into a file
+u8 state_write_file(const char* path)
+{
+    u8    state[STATE_SIZE];
+    FILE* out = fopen(path, "wb");
+    
+    if(out == NULL) { return 0; }
+    
+    state_save(state);
+    u8 ok = fwrite(state, 1, STATE_SIZE, out) == STATE_SIZE;
+    
+    return fclose(out) == 0 && ok;
+}
+
+//load state from a file
+u8 state_read_file(const char* path)
+{
+    u8    state[STATE_SIZE + 1];
+    FILE* in = fopen(path, "rb");
+    
+    if(in == NULL) { return 0; }
+    
+    //one byte more to catch files that are too long
+    u32 size = fread(state, 1, sizeof(state), in);
+    fclose(in);
+    
+    return state_load(state, size);
+}
+
+/*****************/
+//REWIND
+/*****************/
+
+//the frontend captures a state after every frame into a ring of compressed snapshots,
+//every machine with a window has its own ring
+//every REWIND_KEYFRAME-th snapshot is a keyframe, the others are stored as the
+//XOR against their keyframe, run length encoded as { zero bytes, changed bytes, changed bytes... }
+//keyframes are encoded the same way against zero
+#define REWIND_BYTES    (4 << 20)
+#define REWIND_ENTRIES  (60 * 60 * 10) //10 minutes at 60 fps, the byte pool usually runs out first
+#define REWIND_KEYFRAME 60
+
+typedef struct
+{
+    u32 offset; //start in data
+    u32 size;
+    u8  keyframe;
+} rewind_entry_t;
+
+struct rewind_s
+{
+    u8             data[REWIND_BYTES];
+    rewind_entry_t entries[REWIND_ENTRIES];
+    u32            first, count;          //oldest entry and number of entries
+    u32            head;                  //where the next entry is written
+    
+    u8             key[STATE_SIZE];       //keyframe the newest deltas are against
+    u32            key_entry;
+    u8             has_key;               //0 = next capture is a keyframe
+    u32            since_key;             //captures since the keyframe
+    
+    u8             state  [STATE_SIZE];
+    u8             scratch[STATE_SIZE * 2]; //encoded entry, worst case is 3 bytes for every 2
+};
+
+static const u8 rewind_zero[STATE_SIZE];
+
+static u32 rewind_encode(u8* out, const u8* state, const u8* key)
+{
+    u8* p = out;
+    u32 i = 0;
+    
+    while(i < STATE_SIZE)
+    {
+        u32 skip = 0;
+        u32 copy = 0;
+        
+        while(i + skip < STATE_SIZE && skip < 255 && state[i + skip] == key[i + skip]) { skip++; }
+        i += skip;
+        while(i + copy < STATE_SIZE && copy < 255 && state[i + copy] != key[i + copy]) { copy++; }
+        
+        *p++ = skip;
+        *p++ = copy;
+        for(u32 j = 0; j < copy; j++) { *p++ = state[i + j] ^ key[i + j]; }
+        i += copy;
+    }
+    
+    return p - out;
+}
+
+static void rewind_decode(u8* state, const u8* in, const u8* key)
+{
+    u32 i = 0;
+    
+    memcpy(state, key, STATE_SIZE);
+    
+    while(i < STATE_SIZE)
+    {
+        u8 skip = *in++;
+        u8 copy = *in++;
+        
+        i += skip;
+        for(u32 j = 0; j < copy; j++) { state[i++] ^= *in++; }
+    }
+}
+
+static inline rewind_entry_t* rewind_entry(u32 n) { return &rewind_ring.entries[(rewind_ring.first + n) % REWIND_ENTRIES]; }
+
+//drop the oldest keyframe together with its deltas
+static void rewind_evict()
+{
+    do
+    {
+        if(rewind_ring.first == rewind_ring.key_entry) { rewind_ring.has_key = 0; }
+        
+        rewind_ring.first = (rewind_ring.first + 1) % REWIND_ENTRIES;
+        rewind_ring.count--;
+    }
+    while(rewind_ring.count && !rewind_entry(0)->keyframe);
+}
+
+//store the state of the finished frame
+void rewind_capture()
+{
+    rewind_t* r = &rewind_ring;
+    u32       size;
+    u8        keyframe;
+    
+    state_save(r->state);
+    
+    do
+    {
+        keyframe = !r->has_key || r->since_key == REWIND_KEYFRAME;
+        size     = rewind_encode(r->scratch, r->state, keyframe ? rewind_zero : r->key);
+        
+        //skip the end of the pool if the entry does not fit, whatever lived there is older than the start
+        if(r->head + size > REWIND_BYTES)
+        {
+            while(r->count && rewind_entry(0)->offset >= r->head) { rewind_evict(); }
+            r->head = 0;
+        }
+        
+        //make room, evicting the keyframe of this delta means it has to become a keyframe itself
+        while(r->count && (r->count == REWIND_ENTRIES ||
+                           (rewind_entry(0)->offset >= r->head && rewind_entry(0)->offset < r->head + size)))
+        {
+            rewind_evict();
+        }
+    }
+    while(!keyframe && !r->has_key);
+    
+    rewind_entry_t* entry = rewind_entry(r->count++);
+    
+    entry->offset   = r->head;
+    entry->size     = size;
+    entry->keyframe = keyframe;
+    memcpy(r->data + r->head, r->scratch, size);
+    r->head += size;
+    
+    if(keyframe)
+    {
+        memcpy(r->key, r->state, STATE_SIZE);
+        r->key_entry = entry - r->entries;
+        r->has_key   = 1;
+        r->since_key = 0;
+    }
+    
+    r->since_key++;
+}
+
+//go back one frame, the newest entry is the current frame and is dropped
+//returns 0 once the history is used up
+u8 rewind_step()
+{
+    rewind_t* r = &rewind_ring;
+    
+    if(r->count < 2) { return 0; }
+    
+    r->count--;
+    
+    //find the keyframe of the new newest entry
+    u32 n = r->count - 1;
+    while(!rewind_entry(n)->keyframe) { n--; }
+    
+    rewind_entry_t* key   = rewind_entry(n);
+    rewind_entry_t* entry = rewind_entry(r->count - 1);
+    
+    rewind_decode(r->key, r->data + key->offset, rewind_zero);
+    rewind_decode(r->state, r->data + entry->offset, entry->keyframe ? rewind_zero : r->key);
+    
+    r->key_entry = key - r->entries;
+    r->has_key   = 1;
+    r->since_key = r->count - n;
+    r->head      = entry->offset + entry->size;
+    
+    return state_load(r->state, STATE_SIZE);
+}
+
+/*****************/
+//MOVIES
+/*****************/
+
+/*
+ * MOVIE LAYOUT *
+ * little endian
+ * header - 3 byte = { 'C', 'M', 'V' }
+ *          1 byte = version
+ *          8 byte = FNV-1a hash of the ROM it was recorded with
+ *          4 byte = number of frames
+ * runs   - 2 byte = number of frames
+ *          4 byte = CONTROLLER0 and CONTROLLER1 bytes during those frames
+ *
+ * frame n holds the controllers after n finished frames, so replaying it from power on
+ * (or from a state saved at frame n) reproduces the recorded run exactly
+ */
+#define MOVIE_VERSION     1
+#define MOVIE_HEADER_SIZE 16
+#define MOVIE_PADS        4
+
+enum MOVIE_MODE
+{
+    MOVIE_OFF    = 0,
+    MOVIE_RECORD = 1,
+    MOVIE_PLAY   = 2
+};
+
+void movie_record(u64 rom_hash)
+{
+    movie.mode     = MOVIE_RECORD;
+    movie.rom_hash = rom_hash;
+}
+
+//load a movie for playback, returns 0 if the file is broken or made for another ROM
+u8 movie_play(const char* path, u64 rom_hash)
+{
+    u8    header[MOVIE_HEADER_SIZE];
+    u8    run[2 + MOVIE_PADS];
+    FILE* in = fopen(path, "rb");
+    
+    if(in == NULL) { return 0; }
+    
+    const u8* p = header + 4;
+    
+    if(fread(header, 1, sizeof(header), in) != sizeof(header) ||
+       memcmp(header, "CMV", 3) != 0 || header[3] != MOVIE_VERSION || state_get64(&p) != rom_hash)
+    {
+        fclose(in); return 0;
+    }
+    
+    //the frame count comes from the file, a broken one can ask for more than there is
+    u32 capacity = state_get32(&p);
+    u8* pads     = malloc((u64)capacity * MOVIE_PADS + 1);
+    
+    if(pads == NULL) { fclose(in); return 0; }
+    
+    movie.mode     = MOVIE_PLAY;
+    movie.rom_hash = rom_hash;
+    movie.count    = 0;
+    movie.capacity = capacity;
+    movie.pads     = pads;
+    
+    while(movie.count < movie.capacity && fread(run, 1, sizeof(run), in) == sizeof(run))
+    {
+        const u8* q      = run;
+        u32       repeat = state_get16(&q);
+        
+        for(u32 i = 0; i < repeat && movie.count < movie.capacity; i++)
+        {
+            memcpy(movie.pads + movie.count++ * MOVIE_PADS, q, MOVIE_PADS);
+        }
+    }
+    
+    fclose(in);
+    
+    return movie.count == movie.capacity;
+}
+
+//frame boundary, record or replay the controllers for the next frame
+//returns 0 once the played movie is over
+u8 movie_frame()
+{
+    u64 frame = gpu.frames;
+    
+    if(movie.mode == MOVIE_PLAY)
+    {
+        if(frame >= movie.count) { return 0; }
+        
+        memcpy(RAM + CONTROLLER0, movie.pads + frame * MOVIE_PADS, MOVIE_PADS);
+    }
+    else if(movie.mode == MOVIE_RECORD)
+    {
+        if(frame >= movie.capacity)
+        {
+            movie.capacity = movie.capacity ? movie.capacity * 2 : 1024;
+            while(movie.capacity <= frame) { movie.capacity *= 2; }
+            movie.pads = realloc(movie.pads, (u64)movie.capacity * MOVIE_PADS);
+        }
+        
+        //frames left out (a run resumed from a state) hold no input
+        if(frame > movie.count) { memset(movie.pads + movie.count * MOVIE_PADS, 0, (frame - movie.count) * MOVIE_PADS); }
+        
+        //after a rewind the newer frames are recorded over
+        memcpy(movie.pads + frame * MOVIE_PADS, RAM + CONTROLLER0, MOVIE_PADS);
+        movie.count = frame + 1;
+    }
+    
+    return 1;
+}
+
+//write the recorded movie
+//it ends with the last finished frame, input for the frame the run stopped in is left out
+u8 movie_write(const char* path)
+{
+    u8    header[MOVIE_HEADER_SIZE];
+    u8    run[2 + MOVIE_PADS];
+    FILE* out = fopen(path, "wb");
+    
+    if(out == NULL) { return 0; }
+    
+    if(movie.count > gpu.frames) { movie.count = gpu.frames; }
+    
+    memcpy(header, "CMV", 3);
+    header[3] = MOVIE_VERSION;
+    state_put32(state_put64(header + 4, movie.rom_hash), movie.count);
+    
+    u8 ok = fwrite(header, 1, sizeof(header), out) == sizeof(header);
+    
+    for(u32 i = 0; i < movie.count; )
+    {
+        const u8* pads   = movie.pads + i * MOVIE_PADS;
+        u32       repeat = 1;
+        
+        while(i + repeat < movie.count && repeat < 0xFFFF && memcmp(pads, pads + repeat * MOVIE_PADS, MOVIE_PADS) == 0) { repeat++; }
+        
+        memcpy(state_put16(run, repeat), pads, MOVIE_PADS);
+        ok &= fwrite(run, 1, sizeof(run), out) == sizeof(run);
+        
+        i += repeat;
+    }
+    
+    return fclose(out) == 0 && ok;
+}
+
+static void movie_quit()
+{
+    free(movie.pads);
+    movie.pads = NULL;
+    movie.mode = MOVIE_OFF;
+}
+
 /*****************/
-//EMULATOR
+//SDL FRONTEND
 /*****************/
 
 SDL_Window*   window;
 SDL_Renderer* renderer;
 SDL_Texture*  texture;
-u32*          pixels;
 
-//init emulator
-void emu_init()
+//frame pacing
+//speed is a multiple of the 60 Hz frame rate, 0 runs uncapped
+#define FRAME_RATE 60
+
+static u32 speed       = 1;
+static u64 pace_start  = 0; //performance counter at the start of the paced run, 0 = not started
+static u64 pace_count  = 0; //frames paced since pace_start
+static u64 pace_report = 0; //start of the current speed report
+static u64 pace_frames = 0; //frames since pace_report
+
+//the window title shows these, only the main thread touches the window
+static SDL_atomic_t title_speed;
+static SDL_atomic_t title_fps; //measured uncapped rate in tenths of a frame per second, 0 = not measured yet
+
+static void emu_set_speed(u32 n)
+{
+    speed      = n;
+    pace_start = 0;
+    
+    SDL_AtomicSet(&title_fps,   0);
+    SDL_AtomicSet(&title_speed, n);
+}
+
+//wait until the next frame is due
+//frames are due at exact multiples of the frame period from pace_start,
+//so sleep granularity never adds up to drift
+static void emu_pace()
 {
-    cpu.PC    = ROM_START;
-    cpu.SP    = 0xff;
-    cpu.flags = 0;
+    u64 freq = SDL_GetPerformanceFrequency();
+    u64 now  = SDL_GetPerformanceCounter();
     
+    //uncapped runs report their effective speed once a second
+    pace_frames++;
+    if(now - pace_report >= freq)
+    {
+        if(speed == 0) { SDL_AtomicSet(&title_fps, pace_frames * 10 * freq / (now - pace_report)); }
+        
+        pace_report = now;
+        pace_frames = 0;
+    }
     
-    gpu.ctrl       = 0;
-    gpu.sdata      = 0x0300;
-    gpu.tick_index = 0;
-    gpu.vblank     = 0;
+    if(speed == 0) { return; }
     
-    gpu.default_background_color = 0x3F;
+    u64 rate = (u64)FRAME_RATE * speed;
+    u64 due  = pace_start + ++pace_count * freq / rate;
     
-    gpu.palette_index  = 0;
-    gpu.write_reg_high = 1; //big endian
+    //new speed or too far behind (window dragged, debugger), start over from now
+    if(pace_start == 0 || now > due + 4 * freq / rate)
+    {
+        pace_start = now;
+        pace_count = 0;
+        return;
+    }
     
-    gpu.scroll_x = gpu.scroll_y = 0;
+    if(now >= due) { return; }
+    
+    //sleep whole milliseconds, spin the rest
+    u64 ms = (due - now) * 1000 / freq;
+    if(ms > 0) { SDL_Delay(ms); }
+    
+    while(SDL_GetPerformanceCounter() < due) { }
+}
+
+//triple buffering
+//the emulation thread draws into pixels while the main thread shows the newest finished frame,
+//buffers change hands through one atomic slot so neither side ever waits for the other
+#define PRESENT_BUFFERS 3
+#define PRESENT_FRESH   0x100 //the slot holds a frame that was not presented yet
+
+static u8*          present_buffers[PRESENT_BUFFERS];
+static u32          present_draw = 0; //buffer the emulator draws into
+static SDL_atomic_t present_slot;     //last finished buffer
+static SDL_atomic_t present_quit;     //the emulation thread finished
+static SDL_atomic_t present_redraw;   //the window lost its contents, present again even if nothing changed
+static SDL_sem*     present_signal;
+
+//dirty lines
+//the main thread keeps a hash of every line in the texture and only uploads lines that changed,
+//dropped frames do not matter since fresh frames are always compared against the texture itself
+static u64 present_hashes[SCR_HEIGHT];
+static u32 present_rgba[SCR_WIDTH * SCR_HEIGHT];
+
+static u64 present_line_hash(const u8* line)
+{
+    u64 hash = 0;
+    
+    for(u32 i = 0; i < SCR_WIDTH; i += sizeof(u64))
+    {
+        u64 word;
+        memcpy(&word, line + i, sizeof(u64));
+        
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ULL;
+        hash ^= hash >> 29;
+    }
+    
+    return hash;
+}
+
+//follow the speed in the window title
+static void present_title()
+{
+    static int shown_speed = -1;
+    static int shown_fps   = -1;
+    
+    int n   = SDL_AtomicGet(&title_speed);
+    int fps = SDL_AtomicGet(&title_fps);
+    
+    if(n == shown_speed && fps == shown_fps) { return; }
+    
+    char title[64];
+    
+    if(n == 0 && fps) { snprintf(title, sizeof(title), "CPU - uncapped %.1fx (%.0f fps)", fps / 10.0 / FRAME_RATE, fps / 10.0); }
+    else if(n == 0)   { snprintf(title, sizeof(title), "CPU - uncapped"); }
+    else              { snprintf(title, sizeof(title), n == 1 ? "CPU" : "CPU - %ux", n); }
+    
+    SDL_SetWindowTitle(window, title);
+    
+    shown_speed = n;
+    shown_fps   = fps;
+}
+
+//emulation thread, runs the machine of the main thread
+static int present_emulate(void* data)
+{
+    emu = data;
+    emu_run();
+    
+    SDL_AtomicSet(&present_quit, 1);
+    SDL_SemPost(present_signal);
+    
+    return 0;
+}
+
+//the main thread owns the window, it pumps events and presents while the emulation thread runs
+static void sdl_run()
+{
+    u32 shown = 2; //buffer the main thread holds
+    u8  valid = 0; //the texture holds a frame and present_hashes describe it
+    
+    SDL_Thread* thread = SDL_CreateThread(present_emulate, "emulate", emu);
+    
+    while(!SDL_AtomicGet(&present_quit))
+    {
+        //the emulation thread takes the events, keep them coming while it waits in the console
+        SDL_PumpEvents();
+        SDL_SemWaitTimeout(present_signal, 10);
+        
+        present_title();
+        
+        u8 redraw = SDL_AtomicSet(&present_redraw, 0);
+        
+        //only the emulator writes fresh frames into the slot, it cannot go stale until we swap
+        if(SDL_AtomicGet(&present_slot) & PRESENT_FRESH)
+        {
+            shown = SDL_AtomicSet(&present_slot, shown) & ~PRESENT_FRESH;
+            
+            //find the lines that differ from the texture
+            u8* frame = present_buffers[shown];
+            u32 y0    = SCR_HEIGHT;
+            u32 y1    = 0;
+            
+            for(u32 y = 0; y < SCR_HEIGHT; y++)
+            {
+                u64 hash = present_line_hash(frame + y * SCR_WIDTH);
+                
+                if(!valid || hash != present_hashes[y])
+                {
+                    present_hashes[y] = hash;
+                    
+                    if(y < y0) { y0 = y; }
+                    y1 = y + 1;
+                }
+            }
+            
+            valid = 1;
+            
+            //expand and upload only the dirty rectangle
+            if(y0 < y1)
+            {
+                SDL_Rect rect = { 0, y0, SCR_WIDTH, y1 - y0 };
+                
+                expand(present_rgba + y0 * SCR_WIDTH, frame + y0 * SCR_WIDTH, (y1 - y0) * SCR_WIDTH);
+                SDL_UpdateTexture(texture, &rect, present_rgba + y0 * SCR_WIDTH, SCR_WIDTH * sizeof(u32));
+                
+                redraw = 1;
+            }
+        }
+        
+        //identical frames leave the window as it is
+        if(!redraw) { continue; }
+        
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer, texture, NULL, NULL);
+        SDL_RenderPresent(renderer);
+    }
     
+    SDL_WaitThread(thread, NULL);
+}
+
+//hand the finished frame to the main thread and continue in a free buffer
+//a frame the main thread did not get to is dropped
+static void present_frame()
+{
+    present_draw = SDL_AtomicSet(&present_slot, present_draw | PRESENT_FRESH) & ~PRESENT_FRESH;
+    pixels       = present_buffers[present_draw];
+    
+    SDL_SemPost(present_signal);
+}
+
+static void sdl_init()
+{
     SDL_Init(SDL_INIT_VIDEO);
     
     window   = SDL_CreateWindow("CPU", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCR_WIDTH, SCR_HEIGHT, 0);
@@ -642,176 +3571,467 @@ void emu_init()
     SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0xff);
     SDL_RenderClear(renderer);
     
-    pixels   = malloc(SCR_WIDTH * SCR_HEIGHT * 4);
+    //the emulator starts in buffer 0, the slot holds 1, the main thread 2
+    present_buffers[0] = pixels;
+    for(u32 i = 1; i < PRESENT_BUFFERS; i++) { present_buffers[i] = calloc(SCR_WIDTH * SCR_HEIGHT, sizeof(u8)); }
+    
+    present_draw = 0;
+    SDL_AtomicSet(&present_slot, 1);
+    SDL_AtomicSet(&present_quit, 0);
+    SDL_AtomicSet(&present_redraw, 0);
+    
+    present_signal = SDL_CreateSemaphore(0);
+    
+    //backspace rewinds this machine
+    emu->rewind_data = calloc(1, sizeof(rewind_t));
 }
 
-//draw pixel on screen
-static u32 start_ticks = 0;
-static u32 end_ticks   = 0;
-void put_pix(u32 x, u32 y, u32 index)
+//take input, present the frame and wait for the next one, on the emulation thread
+static void sdl_frame()
 {
-    pixels[y * SCR_WIDTH + x] = VGA_PALLETTE[index];
+    static SDL_Event e;
+    static u8        rewinding = 0; //backspace held
     
-    if(x == SCR_WIDTH - 1 && y == SCR_HEIGHT - 1)
+    //the main thread pumps the queue, taking events from it is thread safe
+    while(SDL_PeepEvents(&e, 1, SDL_GETEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT) > 0)
     {
-        static SDL_Event e;
-        
-        while(SDL_PollEvent(&e) != 0)
+        switch(e.type)
         {
-            switch(e.type)
+            case SDL_QUIT: { SET_BIT(cpu.flags, CPU_TERMINATE); break; }
+            case SDL_WINDOWEVENT:
+            {
+                if(e.window.event == SDL_WINDOWEVENT_EXPOSED) { SDL_AtomicSet(&present_redraw, 1); }
+                break;
+            }
+            case SDL_KEYDOWN:
             {
-                case SDL_QUIT: { SET_BIT(cpu.flags, CPU_TERMINATE); break; }
-                case SDL_KEYDOWN:
+                switch(e.key.keysym.sym)
                 {
-                    switch(e.key.keysym.sym)
+                    case SDLK_DOWN:  { SET_BIT(RAM[CONTROLLER0], KEY_DOWN);  break; }
+                    case SDLK_RIGHT: { SET_BIT(RAM[CONTROLLER0], KEY_RIGHT); break; }
+                    case SDLK_LEFT:  { SET_BIT(RAM[CONTROLLER0], KEY_LEFT);  break; }
+                    case SDLK_UP:    { SET_BIT(RAM[CONTROLLER0], KEY_UP);    break; }
+                    case SDLK_v:     { SET_BIT(RAM[CONTROLLER0], KEY_A);     break; }
+                    case SDLK_c:     { SET_BIT(RAM[CONTROLLER0], KEY_B);     break; }
+                    case SDLK_f:     { SET_BIT(RAM[CONTROLLER0], KEY_X);     break; }
+                    case SDLK_d:     { SET_BIT(RAM[CONTROLLER0], KEY_Y);     break; }
+                        
+                    case SDLK_e:     { SET_BIT(RAM[CONTROLLER0 + 1], KEY_SELECT); break; }
+                    case SDLK_r:     { SET_BIT(RAM[CONTROLLER0 + 1], KEY_START);  break; }
+                    case SDLK_s:     { SET_BIT(RAM[CONTROLLER0 + 1], KEY_L1);     break; }
+                    case SDLK_w:     { SET_BIT(RAM[CONTROLLER0 + 1], KEY_L2);     break; }
+                    case SDLK_g:     { SET_BIT(RAM[CONTROLLER0 + 1], KEY_R1);     break; }
+                    case SDLK_t:     { SET_BIT(RAM[CONTROLLER0 + 1], KEY_R2);     break; }
+                        
+                    case SDLK_BACKSPACE: { rewinding = 1; break; }
+                    case SDLK_F8:        { trace_toggle();  break; }
+                    case SDLK_F9:        { debug.stop = DEBUG_USER; break; } //console on stdin
+                        
+                    //speed: 1-9 = n times 60 fps, 0 = uncapped
+                    default:
                     {
-                        case SDLK_DOWN:  { SET_BIT(RAM[CONTROLLER0], KEY_DOWN);  break; }
-                        case SDLK_RIGHT: { SET_BIT(RAM[CONTROLLER0], KEY_RIGHT); break; }
-                        case SDLK_LEFT:  { SET_BIT(RAM[CONTROLLER0], KEY_LEFT);  break; }
-                        case SDLK_UP:    { SET_BIT(RAM[CONTROLLER0], KEY_UP);    break; }
-                        case SDLK_v:     { SET_BIT(RAM[CONTROLLER0], KEY_A);     break; }
-                        case SDLK_c:     { SET_BIT(RAM[CONTROLLER0], KEY_B);     break; }
-                        case SDLK_f:     { SET_BIT(RAM[CONTROLLER0], KEY_X);     break; }
-                        case SDLK_d:     { SET_BIT(RAM[CONTROLLER0], KEY_Y);     break; }
-                            
-                        case SDLK_e:     { SET_BIT(RAM[CONTROLLER0 + 1], KEY_SELECT); break; }
-                        case SDLK_r:     { SET_BIT(RAM[CONTROLLER0 + 1], KEY_START);  break; }
-                        case SDLK_s:     { SET_BIT(RAM[CONTROLLER0 + 1], KEY_L1);     break; }
-                        case SDLK_w:     { SET_BIT(RAM[CONTROLLER0 + 1], KEY_L2);     break; }
-                        case SDLK_g:     { SET_BIT(RAM[CONTROLLER0 + 1], KEY_R1);     break; }
-                        case SDLK_t:     { SET_BIT(RAM[CONTROLLER0 + 1], KEY_R2);     break; }
-                        default: { break; }
+                        if(e.key.keysym.sym >= SDLK_0 && e.key.keysym.sym <= SDLK_9) { emu_set_speed(e.key.keysym.sym - SDLK_0); }
+                        break;
                     }
-                    break;
                 }
-                case SDL_KEYUP:
+                break;
+            }
+            case SDL_KEYUP:
+            {
+                switch(e.key.keysym.sym)
                 {
-                    switch(e.key.keysym.sym)
-                    {
-                        case SDLK_DOWN:  { RESET_BIT(RAM[CONTROLLER0], KEY_DOWN);  break; }
-                        case SDLK_RIGHT: { RESET_BIT(RAM[CONTROLLER0], KEY_RIGHT); break; }
-                        case SDLK_LEFT:  { RESET_BIT(RAM[CONTROLLER0], KEY_LEFT);  break; }
-                        case SDLK_UP:    { RESET_BIT(RAM[CONTROLLER0], KEY_UP);    break; }
-                        case SDLK_v:     { RESET_BIT(RAM[CONTROLLER0], KEY_A);     break; }
-                        case SDLK_c:     { RESET_BIT(RAM[CONTROLLER0], KEY_B);     break; }
-                        case SDLK_f:     { RESET_BIT(RAM[CONTROLLER0], KEY_X);     break; }
-                        case SDLK_d:     { RESET_BIT(RAM[CONTROLLER0], KEY_Y);     break; }
-                            
-                        case SDLK_e:     { RESET_BIT(RAM[CONTROLLER0 + 1], KEY_SELECT); break; }
-                        case SDLK_r:     { RESET_BIT(RAM[CONTROLLER0 + 1], KEY_START);  break; }
-                        case SDLK_s:     { RESET_BIT(RAM[CONTROLLER0 + 1], KEY_L1);     break; }
-                        case SDLK_w:     { RESET_BIT(RAM[CONTROLLER0 + 1], KEY_L2);     break; }
-                        case SDLK_g:     { RESET_BIT(RAM[CONTROLLER0 + 1], KEY_R1);     break; }
-                        case SDLK_t:     { RESET_BIT(RAM[CONTROLLER0 + 1], KEY_R2);     break; }
-                        default: { break; }
-                    }
-                    break;
+                    case SDLK_DOWN:  { RESET_BIT(RAM[CONTROLLER0], KEY_DOWN);  break; }
+                    case SDLK_RIGHT: { RESET_BIT(RAM[CONTROLLER0], KEY_RIGHT); break; }
+                    case SDLK_LEFT:  { RESET_BIT(RAM[CONTROLLER0], KEY_LEFT);  break; }
+                    case SDLK_UP:    { RESET_BIT(RAM[CONTROLLER0], KEY_UP);    break; }
+                    case SDLK_v:     { RESET_BIT(RAM[CONTROLLER0], KEY_A);     break; }
+                    case SDLK_c:     { RESET_BIT(RAM[CONTROLLER0], KEY_B);     break; }
+                    case SDLK_f:     { RESET_BIT(RAM[CONTROLLER0], KEY_X);     break; }
+                    case SDLK_d:     { RESET_BIT(RAM[CONTROLLER0], KEY_Y);     break; }
+                        
+                    case SDLK_e:     { RESET_BIT(RAM[CONTROLLER0 + 1], KEY_SELECT); break; }
+                    case SDLK_r:     { RESET_BIT(RAM[CONTROLLER0 + 1], KEY_START);  break; }
+                    case SDLK_s:     { RESET_BIT(RAM[CONTROLLER0 + 1], KEY_L1);     break; }
+                    case SDLK_w:     { RESET_BIT(RAM[CONTROLLER0 + 1], KEY_L2);     break; }
+                    case SDLK_g:     { RESET_BIT(RAM[CONTROLLER0 + 1], KEY_R1);     break; }
+                    case SDLK_t:     { RESET_BIT(RAM[CONTROLLER0 + 1], KEY_R2);     break; }
+                        
+                    case SDLK_BACKSPACE: { rewinding = 0; break; }
+                    default: { break; }
                 }
-                default:       { break; }
+                break;
             }
+            default:       { break; }
         }
+    }
+    
+    //every frame shown while rewinding is emulated again from the state before it
+    //the controllers keep what is held right now
+    if(rewinding)
+    {
+        u8 controllers[4];
         
-        SDL_UpdateTexture(texture, NULL, pixels, SCR_WIDTH * sizeof(u32));
-        
-        SDL_RenderClear(renderer);
-        SDL_RenderCopy(renderer, texture, NULL, NULL);
-        SDL_RenderPresent(renderer);
-        
-        //keep fps in certain range
-        end_ticks = SDL_GetTicks() - start_ticks;
-        
-        if (1000.0f / 60.0 > end_ticks)
-        {
-            SDL_Delay(1000.0f / 60.0 - end_ticks);
-        }
-        
-        //printf("fps: %g\n", 1000.0 / end_ticks);
-        
-        start_ticks = SDL_GetTicks();
+        memcpy(controllers, RAM + CONTROLLER0, sizeof(controllers));
+        rewind_step();
+        memcpy(RAM + CONTROLLER0, controllers, sizeof(controllers));
     }
+    else { rewind_capture(); }
+    
+    present_frame();
+    
+    //keep fps in certain range
+    emu_pace();
 }
 
-//load ROM into RAM
-void emu_load(u8* program, u32 rom_size)
+static void sdl_quit()
 {
-    if(rom_size > ROM_PAGE_SIZE)
+    free(emu->rewind_data);
+    emu->rewind_data = NULL;
+    
+    SDL_DestroySemaphore(present_signal);
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    
+    //the emulator frees the buffer it draws into
+    for(u32 i = 0; i < PRESENT_BUFFERS; i++)
     {
-        //load first page into the ram
-        //text section of the program must be in first page!
-        for(u32 i = 0; i < ROM_PAGE_SIZE; i++) { RAM[(ROM_START + i)] = program[i]; }
-        
-        //init other pages
-        cart_buffer = malloc(rom_size - ROM_PAGE_SIZE);
+        if(present_buffers[i] != pixels) { free(present_buffers[i]); }
     }
-    else
+    
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+}
+
+static const frontend_t sdl_frontend = { sdl_init, sdl_frame, sdl_quit, sdl_run };
+
+/*****************/
+//HEADLESS FRONTENDS
+/*****************/
+
+//headless mode
+//no window, no input, no frame pacing
+static void headless_none() { }
+
+static const frontend_t headless_frontend = { headless_none, headless_none, headless_none, emu_run };
+
+//scripted mode
+//headless, the controllers follow a text script of "frame pad0 pad0+1 pad1 pad1+1" lines,
+//each line sets the four controller bytes once that many frames are finished
+static FILE* script_file    = NULL;
+static u8    script_pending = 0;    //a line is waiting for its frame
+static u64   script_next    = 0;    //frame of the waiting line
+static u8    script_pads[4];        //controller bytes of the waiting line
+
+static void script_read()
+{
+    unsigned long long frame;
+    int                pads[4];
+    
+    script_pending = fscanf(script_file, "%llu %i %i %i %i", &frame, &pads[0], &pads[1], &pads[2], &pads[3]) == 5;
+    script_next    = frame;
+    
+    for(u32 i = 0; i < 4; i++) { script_pads[i] = pads[i]; }
+}
+
+static void script_frame()
+{
+    while(script_pending && script_next <= gpu.frames)
     {
-        for(u32 i = 0; i < rom_size; i++) { RAM[(ROM_START + i)] = program[i]; }
+        memcpy(RAM + CONTROLLER0, script_pads, sizeof(script_pads));
+        script_read();
     }
 }
 
-//main program
-int main(int argc, char* argv[])
+//lines for frame 0 apply at power on
+static void script_init() { script_read(); script_frame(); }
+static void script_quit() { fclose(script_file); }
+
+static const frontend_t script_frontend = { script_init, script_frame, script_quit, emu_run };
+
+/*****************/
+//BATCH RUNNER
+/*****************/
+
+//-batch list runs every ROM named in list (one path per line) on its own headless machine,
+//worker threads take ROMs from a shared counter until the list is done,
+//summaries are printed in list order once every ROM finished
+typedef struct
 {
-    //open file
-    if(argc != 2)
+    char  path[256];
+    FILE* summary;
+} batch_job_t;
+
+static batch_job_t* batch_jobs  = NULL;
+static u32          batch_count = 0;
+static SDL_atomic_t batch_next;         //next job to take
+
+//run one ROM on a machine of the calling thread
+static void batch_run(batch_job_t* job)
+{
+    rom_t rom;
+    u8    status = rom_open(&rom, job->path);
+    
+    job->summary = tmpfile();
+    
+    if(job->summary == NULL)
     {
-        printf("usage emu [rom.bin]\n"); return 1;
+        if(status == ROM_OK) { rom_close(&rom); }
+        return;
     }
-    FILE* in = fopen(argv[1], "rb");
+    if(status != ROM_OK) { fprintf(job->summary, "%s: %s\n", ROM_ERRORS[status], job->path); return; }
     
-    /*
-     * ROM LAYOUT *
-     * header - 3 byte = { 'C', 'M', 'U' }
-     *          1 byte = number of pages
-     * data
-     */
-    //read file into buffer
-    if(in == NULL) { printf("error opening file: %s\n", argv[1]); return 1; }
+    u64 start_time = SDL_GetPerformanceCounter();
+    
+    emu_init();
+    emu_load(rom.data, rom.pages);
+    
+    //what the program prints belongs to its own summary
+    output = job->summary;
+    
+    emu_run();
+    
+    emu_summary(job->summary, (double)(SDL_GetPerformanceCounter() - start_time) / SDL_GetPerformanceFrequency());
+    emu_quit();
+    rom_close(&rom);
+}
+
+static int batch_worker(void* data)
+{
+    u32 i;
+    
+    (void)data;
     
-    //check header
-    /*u8 header[3];
+    while((i = SDL_AtomicAdd(&batch_next, 1)) < batch_count) { batch_run(&batch_jobs[i]); }
     
-    fread(header, sizeof(char), 3, in);
+    return 0;
+}
+
+//run the list on n threads (0 = one per core), returns 0 if the list cannot be read
+static u8 batch_main(const char* list, u32 threads)
+{
+    FILE* in     = fopen(list, "r");
+    char  line[sizeof(batch_jobs->path)];
+    u32   number = 0;
     
-    if(header[0] != 'C' || header[1] != 'M' || header[2] != 'U')
+    if(in == NULL) { return 0; }
+    
+    while(fgets(line, sizeof(line), in))
     {
-        printf("file: \"%s\" is not CMU file!\n", argv[1]);
-        fclose(in);
-        return 0;
+        number++;
+        
+        //a path that does not fit would turn into two bogus jobs, skip the rest of its line
+        if(strchr(line, '\n') == NULL && !feof(in))
+        {
+            printf("error: %s line %u: path longer than %u characters\n", list, number, (u32)sizeof(line) - 2);
+            
+            int c;
+            while((c = fgetc(in)) != EOF && c != '\n') { }
+            continue;
+        }
+        
+        line[strcspn(line, "\r\n")] = 0;
+        if(line[0] == 0) { continue; }
+        
+        batch_jobs = realloc(batch_jobs, (batch_count + 1) * sizeof(batch_job_t));
+        strcpy(batch_jobs[batch_count].path, line);
+        batch_jobs[batch_count++].summary = NULL;
     }
+    fclose(in);
     
-    //get memory paging info
-    fread(&cart_page_max, sizeof(char), 1, in);*/
+    if(threads == 0)           { threads = SDL_GetCPUCount(); }
+    if(threads > batch_count)  { threads = batch_count; }
     
-    //load first page into the RAM
-    fseek(in, 0, SEEK_END);
-    u32 rom_size = ftell(in);
-    fseek(in, 0, SEEK_SET);
+    SDL_Thread** workers    = malloc(threads * sizeof(SDL_Thread*));
+    u64          start_time = SDL_GetPerformanceCounter();
+    
+    SDL_AtomicSet(&batch_next, 0);
+    
+    for(u32 i = 0; i < threads; i++) { workers[i] = SDL_CreateThread(batch_worker, "batch", NULL); }
+    for(u32 i = 0; i < threads; i++) { SDL_WaitThread(workers[i], NULL); }
+    
+    double seconds = (double)(SDL_GetPerformanceCounter() - start_time) / SDL_GetPerformanceFrequency();
+    
+    for(u32 i = 0; i < batch_count; i++)
+    {
+        FILE* summary = batch_jobs[i].summary;
+        
+        printf("== %s\n", batch_jobs[i].path);
+        
+        if(summary == NULL) { printf("error: no temporary file for the summary\n"); continue; }
+        
+        rewind(summary);
+        while(fgets(line, sizeof(line), summary)) { fputs(line, stdout); }
+        fclose(summary);
+    }
+    
+    printf("batch:   %u roms on %u threads in %.3f s\n", batch_count, threads, seconds);
     
-    u8* buffer = malloc(rom_size);
+    free(workers);
+    free(batch_jobs);
     
-    fread(buffer, sizeof(char), rom_size, in);
+    return 1;
+}
+
+/*****************/
+//MAIN
+/*****************/
+
+//main program
+int main(int argc, char* argv[])
+{
+    const char* rom_path    = NULL;
+    const char* state_in    = NULL;          //-load
+    const char* state_out   = NULL;          //-save
+    const char* movie_in    = NULL;          //-play
+    const char* movie_out   = NULL;          //-record
+    const char* batch       = NULL;          //-batch
+    const char* profile_out = "profile.csv"; //-profile, PROFILE builds only
+    const char* trace_out   = NULL;          //-trace
+    u32         trace_size  = 0;             //-trace-size, records in the ring
+    u32         threads     = 0;             //-threads, 0 = one per core
+    u8          debugger    = 0;             //-debug
+    
+    frontend = &sdl_frontend;
+    
+    for(int i = 1; i < argc; i++)
+    {
+        if(strequ(argv[i], "-headless"))
+        {
+            headless = 1;
+            frontend = &headless_frontend;
+        }
+        else if(strequ(argv[i], "-debug"))
+        {
+            debugger = 1;
+        }
+        else if(strequ(argv[i], "-script"))
+        {
+            if(i + 1 == argc) { printf("error: %s expects a file\n", argv[i]); return 1; }
+            
+            script_file = fopen(argv[++i], "r");
+            if(script_file == NULL) { printf("error opening file: %s\n", argv[i]); return 1; }
+            
+            headless = 1;
+            frontend = &script_frontend;
+        }
+        else if(strequ(argv[i], "-load")  || strequ(argv[i], "-save")   || strequ(argv[i], "-play") ||
+                strequ(argv[i], "-record") || strequ(argv[i], "-batch") || strequ(argv[i], "-profile") || strequ(argv[i], "-trace"))
+        {
+            if(i + 1 == argc) { printf("error: %s expects a file\n", argv[i]); return 1; }
+            
+            if(strequ(argv[i], "-load"))        { state_in    = argv[++i]; }
+            else if(strequ(argv[i], "-save"))   { state_out   = argv[++i]; }
+            else if(strequ(argv[i], "-play"))   { movie_in    = argv[++i]; }
+            else if(strequ(argv[i], "-record")) { movie_out   = argv[++i]; }
+            else if(strequ(argv[i], "-batch"))  { batch       = argv[++i]; }
+            else if(strequ(argv[i], "-trace"))  { trace_out   = argv[++i]; }
+            else                                { profile_out = argv[++i]; }
+        }
+        else if(strequ(argv[i], "-frames") || strequ(argv[i], "-cycles") || strequ(argv[i], "-speed") || strequ(argv[i], "-threads") ||
+                strequ(argv[i], "-trace-size"))
+        {
+            if(i + 1 == argc) { printf("error: %s expects a number\n", argv[i]); return 1; }
+            
+            u64 value = strtoull(argv[i + 1], NULL, 0);
+            if(strequ(argv[i], "-frames"))       { frame_budget = value; }
+            else if(strequ(argv[i], "-cycles"))  { cycle_budget = value; }
+            else if(strequ(argv[i], "-speed"))   { speed        = value; }
+            else if(strequ(argv[i], "-threads")) { threads      = value; }
+            else                                 { trace_size   = value; }
+            i++;
+        }
+        else
+        {
+            rom_path = argv[i];
+        }
+    }
+    
+    if(movie_in && movie_out) { printf("error: -play and -record cannot be combined\n"); return 1; }
+    
+    //many headless machines in parallel, only the budgets apply to them
+    if(batch)
+    {
+        if(state_in || state_out || movie_in || movie_out || script_file || trace_out || debugger)
+        {
+            printf("error: -batch only combines with -frames, -cycles and -threads\n"); return 1;
+        }
+        
+        headless = 1;
+        frontend = &headless_frontend;
+        
+        emu_setup();
+        if(!batch_main(batch, threads)) { printf("error opening file: %s\n", batch); return 1; }
+        
+        return 0;
+    }
+    
+    //open file
+    if(rom_path == NULL)
+    {
+        printf("usage: emu [-headless] [-script file] [-frames n] [-cycles n] [-speed n (0 = uncapped)] [-load state] [-save state] [-play movie | -record movie] [-batch list [-threads n]] [-profile out.csv] [-trace file [-trace-size n]] [-debug] [rom.bin]\n"); return 1;
+    }
+    rom_t rom;
+    u8    status = rom_open(&rom, rom_path);
+    
+    if(status != ROM_OK) { printf("%s: %s\n", ROM_ERRORS[status], rom_path); return 1; }
     
     //init emulator
+    emu_setup();
     emu_init();
+    emu_set_speed(speed);
     
     //load rom
-    emu_load(buffer, rom_size);
+    emu_load(rom.data, rom.pages);
     
-    //emulator loop
-    while(!GET_BIT(cpu.flags, CPU_TERMINATE))
+    //hashing reads the whole image, only movies need it
+    u64 rom_hash = movie_in || movie_out ? fnv1a(rom.data, rom.size) : 0;
+    
+    //resume from a saved state, e.g. past a long boot sequence
+    if(state_in && !state_read_file(state_in))
     {
-        cpu_exec();
+        printf("error loading save state: %s\n", state_in); emu_quit(); return 1;
+    }
+    
+    //movies replace the frontend input, with or without a window
+    if(movie_in && !movie_play(movie_in, rom_hash))
+    {
+        printf("error loading movie: %s (broken or recorded with another ROM)\n", movie_in); emu_quit(); return 1;
+    }
+    if(movie_out) { movie_record(rom_hash); }
+    
+    //record from the first instruction, F8 toggles it later
+    if(trace_size) { trace_records = trace_size; }
+    if(trace_out)  { trace_path = trace_out; }
 #ifdef STEP
-        //usleep(100000);
+    trace_toggle();
+#else
+    if(trace_out)  { trace_toggle(); }
 #endif
+    
+    //open the console before the first instruction
+    debug.stop = debugger ? DEBUG_USER : 0;
+    
+    u64 start_time = SDL_GetPerformanceCounter();
+    
+    frontend->run();
+    
+    if(state_out && !state_write_file(state_out)) { printf("error writing file: %s\n", state_out); }
+    if(movie_out && !movie_write(movie_out))      { printf("error writing file: %s\n", movie_out); }
+    movie_quit();
+    
+    if(headless)
+    {
+        emu_summary(stdout, (double)(SDL_GetPerformanceCounter() - start_time) / SDL_GetPerformanceFrequency());
     }
     
-    free(pixels);
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
-    SDL_DestroyTexture(texture);
-    SDL_Quit();
+#ifdef PROFILE
+    profile_report(stdout, profile_out);
+#else
+    (void)profile_out;
+#endif
+    
+    emu_quit();
+    rom_close(&rom);
     
     return 0;
 }
@@ -27,7 +27,7 @@ static char OP_MODES[] =
     0, 0, 0, 0, 0, 0, 0, 0,
     1, 2, 2, 2, 2, 2, 0, 1,
     1, 2, 1, 1, 3, 3, 0, 0,
-    1, 0, 0, 0, 0, 0, 0, 0,
+    1, 0, 1, 1, 0, 0, 0, 0,
     0, 0, 1, 1, 2, 1
 };
 
@@ -119,3 +119,32 @@ enum OP_CODES
     OP_BNE = 0x2D,        //branch if not equal (if zero flag is unset) (arg: 16-bit intermediate address)
     OP_AOR = 0x2E,        //A = A | argument (arg: 8-bin intermediate value)
 };
+
+/*
+ * EXECUTION TRACE *
+ * written by any build of the emulator (-trace file from the start, F8 or the console t at runtime),
+ * -DSTEP builds record from the first instruction, printed by com -t
+ * header followed by a ring of capacity records, host byte order
+ * record n is stored in slot n % capacity, only the last capacity records survive
+ */
+#define TRACE_VERSION 1
+
+typedef struct
+{
+    char magic[3]; //'C', 'M', 'T'
+    u8   version;
+    u32  capacity; //records in the ring, power of two
+    u64  count;    //records ever written
+    u64  reserved;
+} trace_header_t;
+
+typedef struct
+{
+    u64 cycles;    //cycle counter before the instruction
+    u16 pc;        //address of the operation code
+    u16 arg;       //operand, 8-bit value or 16-bit address
+    u8  op;
+    u8  A, X, Y, SP;
+    u8  flags;     //before the instruction
+    u8  reserved[6];
+} trace_record_t;